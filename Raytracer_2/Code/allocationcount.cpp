@@ -0,0 +1,103 @@
+#include "allocationcount.h"
+
+#include "memoryusage.h"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+#ifdef COUNT_ALLOCATIONS
+    thread_local unsigned long long allocations = 0;
+#endif
+
+    // in front of every block: what to give back to MemoryUsage. Its size
+    // keeps the alignment malloc gives.
+    struct alignas(alignof(std::max_align_t)) Header
+    {
+        std::size_t size;
+        unsigned category;
+    };
+}
+
+// the array and nothrow forms call this one
+void *operator new(std::size_t size)
+{
+#ifdef COUNT_ALLOCATIONS
+    ++allocations;
+#endif
+    void *memory = std::malloc(sizeof(Header) + size);
+    if (!memory)
+        throw std::bad_alloc();
+
+    Header *header = static_cast<Header *>(memory);
+    header->size = size;
+    header->category = MemoryUsage::category();
+    MemoryUsage::allocated(header->category, size);
+    return header + 1;
+}
+
+void operator delete(void *memory) noexcept
+{
+    if (!memory)
+        return;
+
+    Header *header = static_cast<Header *>(memory) - 1;
+    MemoryUsage::freed(header->category, header->size);
+    std::free(header);
+}
+
+void operator delete(void *memory, std::size_t) noexcept
+{
+    operator delete(memory);
+}
+
+// older standard libraries do not route these through the ones above
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+    try {
+        return operator new(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void operator delete(void *memory, std::nothrow_t const &) noexcept
+{
+    operator delete(memory);
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+unsigned long long allocationCount()
+{
+    return allocations;
+}
+
+UncountedAllocations::UncountedAllocations()
+:
+    d_count(allocations)
+{}
+
+UncountedAllocations::~UncountedAllocations()
+{
+    allocations = d_count;
+}
+
+#else
+
+unsigned long long allocationCount()
+{
+    return 0;
+}
+
+UncountedAllocations::UncountedAllocations()
+:
+    d_count(0)
+{}
+
+UncountedAllocations::~UncountedAllocations()
+{}
+
+#endif
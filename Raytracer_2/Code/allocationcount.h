@@ -0,0 +1,20 @@
+#ifndef ALLOCATIONCOUNT_H_
+#define ALLOCATIONCOUNT_H_
+
+// Heap allocations made by the calling thread. Only counted by the global
+// operator new (defined here, see also memoryusage.h) when built with
+// COUNT_ALLOCATIONS (cmake -DCOUNT_ALLOCATIONS=ON); otherwise always 0.
+unsigned long long allocationCount();
+
+// allocations by the calling thread while one exists are not counted, for
+// work done once (a subtree built when first needed) rather than per ray
+class UncountedAllocations
+{
+    unsigned long long d_count;
+
+    public:
+        UncountedAllocations();
+        ~UncountedAllocations();
+};
+
+#endif
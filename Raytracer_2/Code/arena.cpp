@@ -0,0 +1,60 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+namespace
+{
+    size_t const MAX_BLOCK = 1 << 20;   // bytes
+}
+
+Arena::Arena(size_t blockSize)
+:
+    d_blockSize(blockSize)
+{}
+
+Arena::~Arena()
+{
+    for (auto it = d_destructors.rbegin(); it != d_destructors.rend(); ++it)
+        it->destroy(it->object);
+}
+
+void *Arena::allocate(size_t size, size_t alignment)
+{
+    uintptr_t next = reinterpret_cast<uintptr_t>(d_next);
+    uintptr_t aligned = (next + alignment - 1) & ~(alignment - 1);
+
+    if (!d_next || aligned + size > reinterpret_cast<uintptr_t>(d_end)) {
+        addBlock(size + alignment);
+        next = reinterpret_cast<uintptr_t>(d_next);
+        aligned = (next + alignment - 1) & ~(alignment - 1);
+    }
+
+    d_next = reinterpret_cast<char *>(aligned + size);
+    d_used += size;
+    return reinterpret_cast<void *>(aligned);
+}
+
+size_t Arena::bytesUsed() const
+{
+    return d_used;
+}
+
+size_t Arena::bytesReserved() const
+{
+    size_t total = 0;
+    for (Block const &block : d_blocks)
+        total += block.size;
+    return total;
+}
+
+void Arena::addBlock(size_t minimum)
+{
+    size_t const size = max(d_blockSize, minimum);
+    d_blocks.push_back(Block{ unique_ptr<char[]>(new char[size]), size });
+    d_next = d_blocks.back().data.get();
+    d_end = d_next + size;
+    d_blockSize = min(d_blockSize * 2, MAX_BLOCK);
+}
@@ -0,0 +1,70 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Monotonic bump allocator: objects are placed one after another in large
+// blocks and only released together, when the arena is destroyed. Objects
+// that need it are destroyed first, in reverse order of creation. Not
+// thread safe.
+class Arena
+{
+    struct Block
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    struct Destructor
+    {
+        void *object;
+        void (*destroy)(void *);
+    };
+
+    std::vector<Block> d_blocks;
+    std::vector<Destructor> d_destructors;
+    char *d_next = nullptr;     // free space in the last block
+    char *d_end = nullptr;
+    size_t d_blockSize;         // doubles for every block, up to MAX_BLOCK
+    size_t d_used = 0;
+
+    public:
+        explicit Arena(size_t blockSize = 4096);
+        ~Arena();
+
+        Arena(Arena const &) = delete;
+        Arena &operator=(Arena const &) = delete;
+
+        // construct a T in the arena, valid until the arena is destroyed
+        template <typename T, typename... Args>
+        T *make(Args &&...args);
+
+        void *allocate(size_t size, size_t alignment);
+
+        size_t bytesUsed() const;       // by objects, without padding
+        size_t bytesReserved() const;   // by the blocks
+
+    private:
+        void addBlock(size_t minimum);
+};
+
+template <typename T, typename... Args>
+T *Arena::make(Args &&...args)
+{
+    T *object = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+
+    if (!std::is_trivially_destructible<T>::value)
+        d_destructors.push_back(Destructor{ object, [](void *ptr) {
+            static_cast<T *>(ptr)->~T();
+        } });
+
+    return object;
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "batchrenderer.h"
+
+#include "raytracer.h"
+#include "threadpool.h"
+
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+
+#include <glob.h>
+
+using namespace std;
+
+namespace
+{
+    typedef chrono::steady_clock Clock;
+
+    double secondsSince(Clock::time_point start)
+    {
+        return chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct Parsed
+    {
+        unique_ptr<Raytracer> raytracer;    // nullptr if parsing failed
+        double seconds;
+    };
+
+    struct Timing
+    {
+        string file;
+        double parse;
+        double trace;
+        double write;
+    };
+}
+
+BatchRenderer::BatchRenderer(ThreadPool &pool)
+:
+    d_pool(pool),
+    d_textures(make_shared<TextureCache>())
+{}
+
+unsigned BatchRenderer::render(vector<string> const &files)
+{
+    auto const parse = [this](string const &file)
+    {
+        auto const start = Clock::now();
+        unique_ptr<Raytracer> raytracer(new Raytracer(d_textures));
+        if (!raytracer->readScene(file))
+            raytracer.reset();
+        return Parsed{ move(raytracer), secondsSince(start) };
+    };
+
+    auto const batchStart = Clock::now();
+    vector<Timing> timings;
+    unsigned failed = 0;
+
+    future<Parsed> next;
+    if (!files.empty())
+        next = async(launch::async, parse, files[0]);
+
+    for (size_t idx = 0; idx != files.size(); ++idx)
+    {
+        Parsed current = next.get();
+
+        // parse the next scene while this one is traced
+        if (idx + 1 != files.size())
+            next = async(launch::async, parse, files[idx + 1]);
+
+        if (!current.raytracer)
+        {
+            cerr << "Error: reading scene from " << files[idx]
+                 << " failed - no output generated.\n";
+            ++failed;
+            continue;
+        }
+
+        auto const start = Clock::now();
+        RenderStats stats = current.raytracer->renderToFile(
+            Raytracer::outputName(files[idx]), d_pool);
+        double const total = secondsSince(start);
+
+        timings.push_back(Timing{ files[idx], current.seconds,
+                                  stats.traceSeconds,
+                                  total - stats.traceSeconds });
+    }
+
+    cout << "\nScene timings (s):\n"
+         << setw(10) << "parse" << setw(10) << "trace" << setw(10)
+         << "write" << "  scene\n" << fixed << setprecision(3);
+    for (Timing const &timing : timings)
+        cout << setw(10) << timing.parse << setw(10) << timing.trace
+             << setw(10) << timing.write << "  " << timing.file << '\n';
+
+    cout << "Rendered " << timings.size() << " of " << files.size()
+         << " scenes in " << secondsSince(batchStart) << " s.\n";
+    cout.unsetf(ios::floatfield);
+
+    return failed;
+}
+
+vector<string> BatchRenderer::expand(vector<string> const &args)
+{
+    vector<string> files;
+    for (string const &arg : args)
+    {
+        if (arg.find_first_of("*?[") != string::npos)
+        {
+            glob_t matches;
+            if (glob(arg.c_str(), 0, nullptr, &matches) == 0)
+                for (size_t idx = 0; idx != matches.gl_pathc; ++idx)
+                    files.push_back(matches.gl_pathv[idx]);
+            globfree(&matches);
+        }
+        else if (arg.size() > 5 && arg.compare(arg.size() - 5, 5, ".json") == 0)
+            files.push_back(arg);
+        else
+        {
+            ifstream list(arg);
+            if (!list)
+                cerr << "Error: cannot read scene list " << arg << ".\n";
+
+            string line;
+            while (getline(list, line))
+                if (!line.empty() && line[0] != '#')
+                    files.push_back(line);
+        }
+    }
+    return files;
+}
@@ -0,0 +1,33 @@
+#ifndef BATCHRENDERER_H_
+#define BATCHRENDERER_H_
+
+#include "texturecache.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// Renders many scenes in one process. They share the thread pool and the
+// texture cache, and the next scene is parsed while the current one is
+// being traced.
+class BatchRenderer
+{
+    ThreadPool &d_pool;
+    std::shared_ptr<TextureCache> d_textures;
+
+    public:
+        explicit BatchRenderer(ThreadPool &pool);
+
+        // render every scene to a .png next to it and report the timings,
+        // returns the number of scenes that failed
+        unsigned render(std::vector<std::string> const &files);
+
+        // glob patterns and scene files as is, anything else is read as a
+        // list of scene files, one per line
+        static std::vector<std::string> expand(
+            std::vector<std::string> const &args);
+};
+
+#endif
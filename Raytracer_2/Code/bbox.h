@@ -0,0 +1,66 @@
+#ifndef BBOX_H_
+#define BBOX_H_
+
+#include "triple.h"
+
+#include <cmath>
+#include <limits>
+
+// Axis aligned bounding box, empty when default constructed
+class BBox
+{
+    public:
+        Point min;
+        Point max;
+
+        BBox()
+        :
+            min(std::numeric_limits<double>::infinity(),
+                std::numeric_limits<double>::infinity(),
+                std::numeric_limits<double>::infinity()),
+            max(-std::numeric_limits<double>::infinity(),
+                -std::numeric_limits<double>::infinity(),
+                -std::numeric_limits<double>::infinity())
+        {}
+
+        BBox(Point const &lower, Point const &upper)
+        :
+            min(lower),
+            max(upper)
+        {}
+
+        bool empty() const
+        {
+            return min.x > max.x;
+        }
+
+        void extend(Point const &point)
+        {
+            for (int axis = 0; axis != 3; ++axis)
+            {
+                min.data[axis] = std::fmin(min.data[axis], point.data[axis]);
+                max.data[axis] = std::fmax(max.data[axis], point.data[axis]);
+            }
+        }
+
+        void extend(BBox const &box)
+        {
+            if (box.empty())
+                return;
+            extend(box.min);
+            extend(box.max);
+        }
+
+        Point center() const
+        {
+            return (min + max) * 0.5;
+        }
+
+        // radius of the bounding sphere around center()
+        double radius() const
+        {
+            return empty() ? 0.0 : (max - min).length() * 0.5;
+        }
+};
+
+#endif
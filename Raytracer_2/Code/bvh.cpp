@@ -0,0 +1,468 @@
+#include "bvh.h"
+
+#include "memoryusage.h"
+#include "tasks.h"
+
+#include <atomic>
+#include <cassert>
+
+using namespace std;
+
+namespace
+{
+    unsigned const BINS = 16;           // SAH split candidates per axis
+    unsigned const TASK_SIZE = 4096;    // boxes worth a task of their own
+    unsigned const CHUNK = 16384;       // boxes per task when binning
+
+    // node of the binary tree built first, collapsed into 4 wide nodes
+    struct BinaryNode
+    {
+        BVH::Box box;
+        int left = -1;          // -1 for leaves
+        int right = -1;
+        unsigned first = 0;     // leaves: range of order
+        unsigned count = 0;
+    };
+
+    BVH::Box emptyBox()
+    {
+        float const inf = numeric_limits<float>::infinity();
+        return BVH::Box{ { inf, inf, inf }, { -inf, -inf, -inf } };
+    }
+
+    void extend(BVH::Box &box, BVH::Box const &other)
+    {
+        for (int axis = 0; axis != 3; ++axis) {
+            box.min[axis] = min(box.min[axis], other.min[axis]);
+            box.max[axis] = max(box.max[axis], other.max[axis]);
+        }
+    }
+
+    float area(BVH::Box const &box)
+    {
+        float const dx = box.max[0] - box.min[0];
+        float const dy = box.max[1] - box.min[1];
+        float const dz = box.max[2] - box.min[2];
+        return dx * dy + dy * dz + dz * dx;
+    }
+
+    float centroid(BVH::Box const &box, int axis)
+    {
+        return (box.min[axis] + box.max[axis]) / 2;
+    }
+
+    // box of order[begin, end) and box of their centroids
+    struct Bounds
+    {
+        BVH::Box box = emptyBox();
+        BVH::Box centroids = emptyBox();
+
+        void add(BVH::Box const &other)
+        {
+            extend(box, other);
+            for (int axis = 0; axis != 3; ++axis) {
+                float const c = centroid(other, axis);
+                centroids.min[axis] = min(centroids.min[axis], c);
+                centroids.max[axis] = max(centroids.max[axis], c);
+            }
+        }
+
+        void add(Bounds const &other)
+        {
+            extend(box, other.box);
+            extend(centroids, other.centroids);
+        }
+    };
+
+    // in chunks on several threads for large ranges
+    Bounds boundsOf(vector<BVH::Box> const &boxes,
+                    vector<unsigned> const &order, unsigned begin,
+                    unsigned end)
+    {
+        if (end - begin <= CHUNK) {
+            Bounds bounds;
+            for (unsigned pos = begin; pos != end; ++pos)
+                bounds.add(boxes[order[pos]]);
+            return bounds;
+        }
+
+        unsigned const chunks = (end - begin + CHUNK - 1) / CHUNK;
+        vector<Bounds> partial(chunks);
+        Tasks::forEach(chunks, [&](unsigned chunk) {
+            unsigned const last = min(end, begin + (chunk + 1) * CHUNK);
+            for (unsigned pos = begin + chunk * CHUNK; pos != last; ++pos)
+                partial[chunk].add(boxes[order[pos]]);
+        });
+
+        Bounds bounds;
+        for (Bounds const &part : partial)
+            bounds.add(part);
+        return bounds;
+    }
+
+    // split order[begin, end) at the median centroid along the longest
+    // axis of the centroids
+    unsigned splitMedian(vector<BVH::Box> const &boxes,
+                         vector<unsigned> &order, unsigned begin,
+                         unsigned end, BVH::Box const &centroids)
+    {
+        int axis = 0;
+        for (int other = 1; other != 3; ++other)
+            if (centroids.max[other] - centroids.min[other]
+                > centroids.max[axis] - centroids.min[axis])
+                axis = other;
+
+        unsigned const mid = begin + (end - begin) / 2;
+        nth_element(order.begin() + begin, order.begin() + mid,
+                    order.begin() + end, [&](unsigned a, unsigned b) {
+                        return centroid(boxes[a], axis)
+                            < centroid(boxes[b], axis);
+                    });
+        return mid;
+    }
+
+    struct Bin
+    {
+        BVH::Box box = emptyBox();
+        unsigned count = 0;
+    };
+
+    // split order[begin, end) where the surface area heuristic is lowest,
+    // among BINS equal slices of the centroids' box along every axis
+    unsigned splitSAH(vector<BVH::Box> const &boxes, vector<unsigned> &order,
+                      unsigned begin, unsigned end,
+                      BVH::Box const &centroids)
+    {
+        float scale[3];
+        for (int axis = 0; axis != 3; ++axis) {
+            float const extent = centroids.max[axis] - centroids.min[axis];
+            scale[axis] = extent > 0 ? BINS * (1 - 1e-6f) / extent : 0;
+        }
+        auto binOf = [&](BVH::Box const &box, int axis) {
+            unsigned const bin = (centroid(box, axis) - centroids.min[axis])
+                * scale[axis];
+            return min(bin, BINS - 1);
+        };
+
+        auto fill = [&](Bin *bins, unsigned first, unsigned last) {
+            for (unsigned pos = first; pos != last; ++pos) {
+                BVH::Box const &box = boxes[order[pos]];
+                for (int axis = 0; axis != 3; ++axis) {
+                    Bin &bin = bins[axis * BINS + binOf(box, axis)];
+                    extend(bin.box, box);
+                    ++bin.count;
+                }
+            }
+        };
+
+        // bins per chunk on several threads for large ranges, then summed
+        Bin bins[3 * BINS];
+        if (end - begin <= CHUNK) {
+            fill(bins, begin, end);
+        } else {
+            unsigned const chunks = (end - begin + CHUNK - 1) / CHUNK;
+            vector<Bin> partial(chunks * 3 * BINS);
+            Tasks::forEach(chunks, [&](unsigned chunk) {
+                fill(&partial[chunk * 3 * BINS], begin + chunk * CHUNK,
+                     min(end, begin + (chunk + 1) * CHUNK));
+            });
+            for (unsigned chunk = 0; chunk != chunks; ++chunk)
+                for (unsigned idx = 0; idx != 3 * BINS; ++idx) {
+                    Bin const &part = partial[chunk * 3 * BINS + idx];
+                    extend(bins[idx].box, part.box);
+                    bins[idx].count += part.count;
+                }
+        }
+
+        // cost of splitting after bin idx: the area of each side's box
+        // times its number of boxes
+        int bestAxis = -1;
+        unsigned bestBin = 0;
+        float bestCost = numeric_limits<float>::infinity();
+        for (int axis = 0; axis != 3; ++axis) {
+            if (scale[axis] == 0)
+                continue;
+
+            Bin const *axisBins = bins + axis * BINS;
+            float rightCost[BINS];
+            BVH::Box right = emptyBox();
+            unsigned rightCount = 0;
+            for (unsigned idx = BINS - 1; idx != 0; --idx) {
+                extend(right, axisBins[idx].box);
+                rightCount += axisBins[idx].count;
+                rightCost[idx - 1] = rightCount ? area(right) * rightCount
+                                                : -1;
+            }
+
+            BVH::Box left = emptyBox();
+            unsigned leftCount = 0;
+            for (unsigned idx = 0; idx != BINS - 1; ++idx) {
+                extend(left, axisBins[idx].box);
+                leftCount += axisBins[idx].count;
+                if (leftCount == 0 || rightCost[idx] < 0)
+                    continue;
+
+                float const cost = area(left) * leftCount + rightCost[idx];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = idx;
+                }
+            }
+        }
+
+        // all centroids in one place
+        if (bestAxis < 0)
+            return begin + (end - begin) / 2;
+
+        return partition(order.begin() + begin, order.begin() + end,
+                         [&](unsigned idx) {
+                             return binOf(boxes[idx], bestAxis) <= bestBin;
+                         }) - order.begin();
+    }
+
+    // binary tree over order[begin, end), large subtrees are built on
+    // other threads. Node indices are handed out in pairs of siblings.
+    class Builder
+    {
+        vector<BVH::Box> const &d_boxes;
+        vector<unsigned> &d_order;
+        unsigned d_leafSize;
+        bool d_fast;
+        atomic<unsigned> d_used;
+
+        public:
+            vector<BinaryNode> nodes;
+
+            Builder(vector<BVH::Box> const &boxes, vector<unsigned> &order,
+                    unsigned leafSize, bool fast)
+            :
+                d_boxes(boxes),
+                d_order(order),
+                d_leafSize(leafSize),
+                d_fast(fast),
+                d_used(1),
+                // every leaf holds a box, so there are fewer than twice
+                // as many nodes as boxes
+                nodes(max<size_t>(1, 2 * boxes.size()))
+            {}
+
+            void build(unsigned idx, unsigned begin, unsigned end,
+                       unsigned depth)
+            {
+                Bounds const bounds = boundsOf(d_boxes, d_order, begin, end);
+                nodes[idx].box = bounds.box;
+
+                if (end - begin <= d_leafSize) {
+                    nodes[idx].first = begin;
+                    nodes[idx].count = end - begin;
+                    return;
+                }
+
+                // median splits from here on still end within MAX_DEPTH
+                unsigned levels = 0;
+                while ((d_leafSize << levels) < end - begin)
+                    ++levels;
+                unsigned const mid = d_fast || depth + levels >= BVH::MAX_DEPTH
+                    ? splitMedian(d_boxes, d_order, begin, end,
+                                  bounds.centroids)
+                    : splitSAH(d_boxes, d_order, begin, end,
+                               bounds.centroids);
+
+                unsigned const left = d_used.fetch_add(2);
+                nodes[idx].left = left;
+                nodes[idx].right = left + 1;
+
+                if (end - begin >= TASK_SIZE) {
+                    Tasks::invoke(
+                        [&] { build(left, begin, mid, depth + 1); },
+                        [&] { build(left + 1, mid, end, depth + 1); });
+                } else {
+                    build(left, begin, mid, depth + 1);
+                    build(left + 1, mid, end, depth + 1);
+                }
+            }
+    };
+
+    // ranges of at most maxSize of order[begin, end), left to right
+    vector<pair<unsigned, unsigned>> partitionRange(
+        vector<BVH::Box> const &boxes, vector<unsigned> &order,
+        unsigned begin, unsigned end, unsigned maxSize)
+    {
+        if (end - begin <= maxSize)
+            return { make_pair(begin, end) };
+
+        Bounds const bounds = boundsOf(boxes, order, begin, end);
+        unsigned const mid = splitMedian(boxes, order, begin, end,
+                                         bounds.centroids);
+
+        vector<pair<unsigned, unsigned>> left;
+        vector<pair<unsigned, unsigned>> right;
+        auto const buildLeft = [&] {
+            left = partitionRange(boxes, order, begin, mid, maxSize);
+        };
+        auto const buildRight = [&] {
+            right = partitionRange(boxes, order, mid, end, maxSize);
+        };
+        if (end - begin >= TASK_SIZE) {
+            Tasks::invoke(buildLeft, buildRight);
+        } else {
+            buildLeft();
+            buildRight();
+        }
+
+        left.insert(left.end(), right.begin(), right.end());
+        return left;
+    }
+
+    // quantized bound along one axis that still contains value, as the
+    // traversal decodes it
+    uint8_t quantize(float value, float origin, float scale, bool upper)
+    {
+        float const steps = (value - origin) / scale;
+        int q = upper ? ceil(steps) : floor(steps);
+        q = max(0, min(255, q));
+        if (upper)
+            while (q < 255 && origin + q * scale < value)
+                ++q;
+        else
+            while (q > 0 && origin + q * scale > value)
+                --q;
+        return q;
+    }
+
+    // appends the 4 wide node for binary node idx (and its subtree)
+    unsigned collapse(vector<BinaryNode> const &binary, int idx,
+                      vector<BVH::Node> &nodes)
+    {
+        // open up the largest inner child until there are 4 children
+        vector<int> children;
+        if (binary[idx].left < 0)
+            children.push_back(idx);    // a leaf as root
+        else
+            children = { binary[idx].left, binary[idx].right };
+
+        while (children.size() < BVH::WIDTH) {
+            int widest = -1;
+            for (unsigned pos = 0; pos != children.size(); ++pos)
+                if (binary[children[pos]].left >= 0
+                    && (widest < 0 || area(binary[children[pos]].box)
+                                      > area(binary[children[widest]].box)))
+                    widest = pos;
+            if (widest < 0)
+                break;
+
+            int const opened = children[widest];
+            children[widest] = binary[opened].left;
+            children.push_back(binary[opened].right);
+        }
+
+        unsigned const nodeIdx = nodes.size();
+        nodes.emplace_back();
+
+        BVH::Box const &box = binary[idx].box;
+        BVH::Node node;
+        for (int axis = 0; axis != 3; ++axis) {
+            node.origin[axis] = box.min[axis];
+            float const extent = box.max[axis] - box.min[axis];
+            node.scale[axis] = extent > 0 ? extent / 255 * (1 + 1e-6f)
+                                          : 1e-30f;
+        }
+
+        for (unsigned slot = 0; slot != BVH::WIDTH; ++slot) {
+            if (slot >= children.size()) {
+                node.child[slot] = BVH::EMPTY;
+                for (int axis = 0; axis != 3; ++axis) {
+                    node.lo[axis][slot] = 255;
+                    node.hi[axis][slot] = 0;
+                }
+                continue;
+            }
+
+            BinaryNode const &child = binary[children[slot]];
+            for (int axis = 0; axis != 3; ++axis) {
+                node.lo[axis][slot] = quantize(child.box.min[axis],
+                    node.origin[axis], node.scale[axis], false);
+                node.hi[axis][slot] = quantize(child.box.max[axis],
+                    node.origin[axis], node.scale[axis], true);
+            }
+
+            if (child.left < 0) {
+                assert(child.count <= BVH::MAX_LEAF && child.first < 1 << 24);
+                node.child[slot] = BVH::LEAF | child.first << 7 | child.count;
+            } else {
+                node.child[slot] = collapse(binary, children[slot], nodes);
+            }
+        }
+
+        nodes[nodeIdx] = node;
+        return nodeIdx;
+    }
+}
+
+vector<BVH::Node> BVH::build(vector<Box> const &boxes, unsigned leafSize,
+    vector<unsigned> &order, bool fast)
+{
+    MemoryUsage::Scope const scope(MemoryUsage::ACCELERATION);
+    if (leafSize > MAX_LEAF)
+        leafSize = MAX_LEAF;
+    order.resize(boxes.size());
+    for (unsigned idx = 0; idx != boxes.size(); ++idx)
+        order[idx] = idx;
+
+    Builder builder(boxes, order, leafSize, fast);
+    builder.build(0, 0, boxes.size(), 0);
+
+    vector<Node> nodes;
+    collapse(builder.nodes, 0, nodes);
+    return nodes;
+}
+
+vector<pair<unsigned, unsigned>> BVH::partition(vector<Box> const &boxes,
+    unsigned maxSize, vector<unsigned> &order)
+{
+    order.resize(boxes.size());
+    for (unsigned idx = 0; idx != boxes.size(); ++idx)
+        order[idx] = idx;
+
+    return partitionRange(boxes, order, 0, boxes.size(), maxSize);
+}
+
+BVH::Box BVH::bounds(Node const &root)
+{
+    Box box = emptyBox();
+    for (unsigned slot = 0; slot != WIDTH; ++slot) {
+        if (root.child[slot] == EMPTY)
+            continue;
+
+        for (int axis = 0; axis != 3; ++axis) {
+            box.min[axis] = min(box.min[axis], root.origin[axis]
+                                + root.lo[axis][slot] * root.scale[axis]);
+            box.max[axis] = max(box.max[axis], root.origin[axis]
+                                + root.hi[axis][slot] * root.scale[axis]);
+        }
+    }
+    return box;
+}
+
+BVH::TraceRay BVH::prepare(double const O[3], double const D[3],
+    Node const &root)
+{
+    // single precision rounding of the ray origin and of the decoded
+    // boxes is covered by growing the boxes a little
+    double magnitude = 0;
+    TraceRay ray;
+    for (int axis = 0; axis != 3; ++axis) {
+        ray.O[axis] = O[axis];
+        // a zero direction would give 0 * inf = NaN in the slab test
+        double const dir = D[axis] != 0 ? D[axis] : 1e-30;
+        ray.inv[axis] = fmax(fmin(1 / dir, 1e30), -1e30);
+
+        magnitude = fmax(magnitude, fabs(O[axis]));
+        magnitude = fmax(magnitude, fabs(root.origin[axis]));
+        magnitude = fmax(magnitude, fabs(root.origin[axis]
+                                         + 255 * root.scale[axis]));
+    }
+    ray.pad = magnitude * 1e-6;
+    return ray;
+}
@@ -0,0 +1,196 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Bounding volume hierarchy with 4 children per node. A node stores the
+// boxes of its children quantized to 8 bits within its own box, so it
+// fits in 64 bytes (a binary tree needs about 3 times as much for the
+// same boxes), and all 4 children are tested at once. Nodes are plain
+// data, they can be written to and read from disk as they are.
+class BVH
+{
+    public:
+        static unsigned const WIDTH = 4;
+        static uint32_t const LEAF = 1u << 31;      // child is a leaf
+        static uint32_t const EMPTY = ~0u;          // unused child slot
+        static unsigned const MAX_LEAF = 127;       // boxes in a leaf
+        static unsigned const MAX_DEPTH = 48;       // of the binary tree
+
+        struct Box
+        {
+            float min[3];
+            float max[3];
+        };
+
+        struct Node
+        {
+            float origin[3];        // lower corner of the node's box
+            float scale[3];         // size of a quantization step
+            uint8_t lo[3][WIDTH];   // per axis and child
+            uint8_t hi[3][WIDTH];
+            // index of a child node, or LEAF | first << 7 | count with
+            // first indexing the order the tree was built with
+            uint32_t child[WIDTH];
+        };
+
+        // ray in the tree's coordinates, with 1 / direction
+        struct TraceRay
+        {
+            float O[3];
+            float inv[3];
+            float pad;              // boxes are grown by this, for rounding
+        };
+
+        // builds the tree over boxes, leaves hold at most leafSize of them.
+        // order receives the box indices in leaf order. Boxes are split
+        // where the surface area heuristic (binned) is lowest, or at the
+        // median when fast, which builds quicker but traces slower. Large
+        // builds use several threads (see Tasks).
+        static std::vector<Node> build(std::vector<Box> const &boxes,
+                                       unsigned leafSize,
+                                       std::vector<unsigned> &order,
+                                       bool fast = false);
+
+        // splits boxes into groups of at most maxSize nearby boxes, as
+        // ranges [first, second) of order
+        static std::vector<std::pair<unsigned, unsigned>> partition(
+            std::vector<Box> const &boxes, unsigned maxSize,
+            std::vector<unsigned> &order);
+
+        static Box bounds(Node const &root);
+
+        static TraceRay prepare(double const O[3], double const D[3],
+                                Node const &root);
+
+        // calls leaf(first, count) for every leaf whose box the ray
+        // enters before tMax, nearest first; leaf may lower tMax
+        template <typename Leaf>
+        static void traverse(Node const *nodes, TraceRay const &ray,
+                             double const &tMax, Leaf const &leaf);
+
+    private:
+        // entry distances of the children hit before tMax, +inf otherwise
+        static void intersect(Node const &node, TraceRay const &ray,
+                              float tMax, float tNear[WIDTH]);
+};
+
+inline void BVH::intersect(Node const &node, TraceRay const &ray, float tMax,
+                           float tNear[WIDTH])
+{
+#ifdef __SSE2__
+    __m128i const zero = _mm_setzero_si128();
+    __m128 near = _mm_setzero_ps();
+    __m128 far = _mm_set1_ps(tMax);
+    __m128 const pad = _mm_set1_ps(ray.pad);
+
+    for (int axis = 0; axis != 3; ++axis) {
+        // 4 bytes to 4 floats
+        int32_t loBytes;
+        int32_t hiBytes;
+        std::copy(node.lo[axis], node.lo[axis] + WIDTH,
+                  reinterpret_cast<uint8_t *>(&loBytes));
+        std::copy(node.hi[axis], node.hi[axis] + WIDTH,
+                  reinterpret_cast<uint8_t *>(&hiBytes));
+        __m128 const qlo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(loBytes), zero), zero));
+        __m128 const qhi = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(hiBytes), zero), zero));
+
+        __m128 const origin = _mm_set1_ps(node.origin[axis]);
+        __m128 const scale = _mm_set1_ps(node.scale[axis]);
+        __m128 const lo = _mm_sub_ps(_mm_add_ps(origin,
+                                                _mm_mul_ps(qlo, scale)), pad);
+        __m128 const hi = _mm_add_ps(_mm_add_ps(origin,
+                                                _mm_mul_ps(qhi, scale)), pad);
+
+        __m128 const O = _mm_set1_ps(ray.O[axis]);
+        __m128 const inv = _mm_set1_ps(ray.inv[axis]);
+        __m128 const t0 = _mm_mul_ps(_mm_sub_ps(lo, O), inv);
+        __m128 const t1 = _mm_mul_ps(_mm_sub_ps(hi, O), inv);
+        near = _mm_max_ps(near, _mm_min_ps(t0, t1));
+        far = _mm_min_ps(far, _mm_max_ps(t0, t1));
+    }
+
+    __m128 const missed = _mm_cmpgt_ps(near, far);
+    __m128 const inf = _mm_set1_ps(std::numeric_limits<float>::infinity());
+    _mm_storeu_ps(tNear, _mm_or_ps(_mm_and_ps(missed, inf),
+                                   _mm_andnot_ps(missed, near)));
+#else
+    for (unsigned idx = 0; idx != WIDTH; ++idx) {
+        float near = 0;
+        float far = tMax;
+        for (int axis = 0; axis != 3; ++axis) {
+            float const lo = node.origin[axis]
+                + node.lo[axis][idx] * node.scale[axis] - ray.pad;
+            float const hi = node.origin[axis]
+                + node.hi[axis][idx] * node.scale[axis] + ray.pad;
+            float const t0 = (lo - ray.O[axis]) * ray.inv[axis];
+            float const t1 = (hi - ray.O[axis]) * ray.inv[axis];
+            near = std::max(near, std::min(t0, t1));
+            far = std::min(far, std::max(t0, t1));
+        }
+        tNear[idx] = near <= far ? near
+                                 : std::numeric_limits<float>::infinity();
+    }
+#endif
+}
+
+template <typename Leaf>
+void BVH::traverse(Node const *nodes, TraceRay const &ray,
+                   double const &tMax, Leaf const &leaf)
+{
+    // nodes, or leaves (LEAF set), still to visit and where the ray
+    // enters them; every level leaves at most 3 siblings behind
+    uint32_t stack[3 * MAX_DEPTH + 1];
+    float entered[3 * MAX_DEPTH + 1];
+    unsigned top = 0;
+    stack[top] = 0;
+    entered[top++] = 0;
+
+    while (top != 0) {
+        --top;
+        if (entered[top] > tMax * (1 + 1e-6))
+            continue;
+
+        uint32_t const entry = stack[top];
+        if (entry & LEAF) {
+            leaf((entry & ~LEAF) >> 7, entry & MAX_LEAF);
+            continue;
+        }
+
+        Node const &node = nodes[entry];
+        float tNear[WIDTH];
+        intersect(node, ray, std::fmin(tMax * (1 + 1e-6), 3e38), tNear);
+
+        // push the children hit, the nearest last so it is visited first
+        unsigned hits[WIDTH];
+        unsigned count = 0;
+        for (unsigned idx = 0; idx != WIDTH; ++idx) {
+            if (node.child[idx] == EMPTY || std::isinf(tNear[idx]))
+                continue;
+
+            unsigned pos = count++;
+            while (pos != 0 && tNear[hits[pos - 1]] < tNear[idx]) {
+                hits[pos] = hits[pos - 1];
+                --pos;
+            }
+            hits[pos] = idx;
+        }
+        for (unsigned idx = 0; idx != count; ++idx) {
+            stack[top] = node.child[hits[idx]];
+            entered[top++] = tNear[hits[idx]];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,39 @@
+#include "camera.h"
+
+#include <cmath>
+#include <stdexcept>
+
+using namespace std;
+
+void Camera::update()
+{
+    if (!hasView)
+        return;
+
+    Vector const view = center - eye;
+    Vector const side = view.cross(up);
+    if (!(side.length() > 1e-9 * view.length() * up.length()))
+        throw runtime_error("Camera up must not be zero or parallel to "
+                            "the view direction.");
+
+    d_forward = view.normalized();
+    d_right = side.normalized();
+    d_upward = d_right.cross(d_forward);
+    d_scale = 2 * tan(fov * acos(-1) / 360) / height;
+}
+
+Ray Camera::ray(double x, double y) const
+{
+    if (!hasView)
+    {
+        // the original mapping: sample x lands on world x + 0.5
+        Point pixel(0.5 + x, 0.5 + (height - y - 1), 0);
+        return Ray(eye, (pixel - eye).normalized());
+    }
+
+    Vector dir = d_forward
+        + (x - 0.5 * width) * d_scale * d_right
+        + (0.5 * height - y) * d_scale * d_upward;
+
+    return Ray(eye, dir.normalized());
+}
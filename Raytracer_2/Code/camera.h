@@ -0,0 +1,38 @@
+#ifndef CAMERA_H_
+#define CAMERA_H_
+
+#include "ray.h"
+#include "triple.h"
+
+class Camera
+{
+    public:
+        Point eye;
+        unsigned width = 400;
+        unsigned height = 400;
+
+        // Without a view, the image plane is z = 0 and pixel (x, y) is at
+        // world position (x, height - y): the original "Eye" scenes.
+        // Otherwise it is a pinhole camera looking at center.
+        bool hasView = false;
+        Point center;
+        Vector up = Vector(0, 1, 0);
+        double fov = 45;            // vertical field of view in degrees
+
+        // set up the view from the members above, required after changing
+        // them; throws when up is zero or along the view direction, or
+        // eye and center coincide
+        void update();
+
+        // ray through image position (x, y); pixel (i, j) covers
+        // [i, i + 1) x [j, j + 1) and y grows downwards
+        Ray ray(double x, double y) const;
+
+    private:
+        Vector d_forward;
+        Vector d_right;
+        Vector d_upward;
+        double d_scale = 0;         // size of a pixel at distance 1
+};
+
+#endif
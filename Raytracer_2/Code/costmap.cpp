@@ -0,0 +1,75 @@
+#include "costmap.h"
+
+#include "image.h"
+#include "scene.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+    // heat colours, evenly spaced from cost 0 to the scale
+    Color const HEAT[] = { Color(0, 0, 0), Color(0.75, 0, 0),
+                           Color(1, 0.85, 0), Color(1, 1, 1) };
+    unsigned const STEPS = sizeof HEAT / sizeof HEAT[0] - 1;
+
+    Color heat(float fraction)
+    {
+        float const position = min(max(fraction, 0.0f), 1.0f) * STEPS;
+        unsigned const step = min(static_cast<unsigned>(position),
+                                   STEPS - 1);
+        float const along = position - step;
+        return HEAT[step] * (1 - along) + HEAT[step + 1] * along;
+    }
+}
+
+CostMap::CostMap(unsigned metric)
+:
+    d_metric(metric)
+{}
+
+unsigned CostMap::metric() const
+{
+    return d_metric;
+}
+
+char const *CostMap::unit() const
+{
+    return d_metric == TIME ? "ns" : "rays";
+}
+
+void CostMap::resize(unsigned width, unsigned height)
+{
+    d_width = width;
+    d_height = height;
+    d_costs.assign(width * height, 0);
+}
+
+float CostMap::scale(CropWindow const &window) const
+{
+    vector<float> costs;
+    for (unsigned y = window.y0; y < window.y1 && y < d_height; ++y)
+        for (unsigned x = window.x0; x < window.x1 && x < d_width; ++x)
+            costs.push_back(d_costs[y * d_width + x]);
+    if (costs.empty())
+        return 0;
+
+    auto const percentile = costs.begin() + (costs.size() - 1) * 99 / 100;
+    nth_element(costs.begin(), percentile, costs.end());
+    if (*percentile > 0)
+        return *percentile;
+    return *max_element(costs.begin(), costs.end());
+}
+
+Image CostMap::image(float scale) const
+{
+    Image img(d_width, d_height);
+    float const inverse = scale > 0 ? 1 / scale : 0;
+    for (unsigned y = 0; y != d_height; ++y) {
+        Image::Row row = img.row(y);
+        for (unsigned x = 0; x != d_width; ++x)
+            row.put(x, heat(d_costs[y * d_width + x] * inverse));
+    }
+    return img;
+}
@@ -0,0 +1,48 @@
+#ifndef COSTMAP_H_
+#define COSTMAP_H_
+
+#include <vector>
+
+class Image;
+struct CropWindow;
+
+// What every pixel cost to render, to see where the time of a frame goes:
+// reflective clusters, dense geometry and supersampled edges show up as
+// hot spots.
+class CostMap
+{
+    unsigned d_metric;
+    unsigned d_width = 0;
+    unsigned d_height = 0;
+    std::vector<float> d_costs;
+
+    public:
+        static unsigned const NONE = 0;
+        static unsigned const RAYS = 1;     // camera, reflection and shadow
+        static unsigned const TIME = 2;     // nanoseconds
+
+        explicit CostMap(unsigned metric);
+
+        unsigned metric() const;
+        char const *unit() const;           // of metric, for messages
+
+        // costs for an image of this size, all zero
+        void resize(unsigned width, unsigned height);
+
+        // unchecked
+        void put(unsigned x, unsigned y, float cost)
+        {
+            d_costs[y * d_width + x] = cost;
+        }
+
+        // the 99th percentile of the costs inside window (the pixels
+        // rendered), as not to let a few pixels set the scale; their
+        // maximum when that is 0
+        float scale(CropWindow const &window) const;
+
+        // costs from black (none) through red and yellow to white (scale
+        // and up)
+        Image image(float scale) const;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "denoiser.h"
+
+#include "image.h"
+#include "scene.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    // planes of the guide buffer
+    unsigned const ALBEDO = 0;
+    unsigned const NORMAL = 3;
+    unsigned const DEPTH = 6;
+    unsigned const GUIDES = 7;
+
+    // B3 spline taps
+    float const KERNEL[5] = { 1 / 16.0f, 1 / 4.0f, 3 / 8.0f, 1 / 4.0f,
+                              1 / 16.0f };
+
+    // how different a tap may be before it stops counting: colour (halved
+    // every pass, as the noise left gets finer), albedo, normal and depth
+    // relative to the pixel's, per pixel of tap spacing
+    float const SIGMA_COLOR = 0.5f;
+    float const SIGMA_ALBEDO = 0.1f;
+    float const SIGMA_NORMAL = 0.3f;
+    float const SIGMA_DEPTH = 0.02f;
+
+    // weights are never below e^-MAX_DISTANCE, so sums stay clear of
+    // denormals (which are very slow)
+    float const MAX_DISTANCE = 60;
+
+    unsigned const ROWS = 4;                // rows per task
+
+    struct Pass
+    {
+        float const *in;                    // 3 colour planes
+        float *out;
+        float const *guides;
+        unsigned plane;                     // floats per plane
+        unsigned width;
+        CropWindow window;
+        int step;
+        float invColor;                     // 1 / sigma^2
+        float invAlbedo;
+        float invNormal;
+    };
+
+    // 1 / (relative depth sigma) for a pixel; misses (depth 0) then
+    // reject every hit
+    float invDepth(float depth, int step)
+    {
+        return 1 / (SIGMA_DEPTH * step * max(depth, 1e-9f));
+    }
+
+    void filterPixel(Pass const &pass, unsigned x, unsigned y)
+    {
+        unsigned const plane = pass.plane;
+        unsigned const idx = y * pass.width + x;
+        float const *in = pass.in;
+        float const *guides = pass.guides;
+        float const zInv = invDepth(guides[DEPTH * plane + idx], pass.step);
+
+        float sum[3] = { 0, 0, 0 };
+        float weights = 0;
+        for (int dy = -2; dy <= 2; ++dy) {
+            int const qy = int(y) + dy * pass.step;
+            if (qy < int(pass.window.y0) || qy >= int(pass.window.y1))
+                continue;
+            for (int dx = -2; dx <= 2; ++dx) {
+                int const qx = int(x) + dx * pass.step;
+                if (qx < int(pass.window.x0) || qx >= int(pass.window.x1))
+                    continue;
+
+                unsigned const q = qy * pass.width + qx;
+                float color = 0;
+                float albedo = 0;
+                float normal = 0;
+                for (unsigned ch = 0; ch != 3; ++ch) {
+                    float const dc = in[ch * plane + idx]
+                        - in[ch * plane + q];
+                    float const da = guides[(ALBEDO + ch) * plane + idx]
+                        - guides[(ALBEDO + ch) * plane + q];
+                    float const dn = guides[(NORMAL + ch) * plane + idx]
+                        - guides[(NORMAL + ch) * plane + q];
+                    color += dc * dc;
+                    albedo += da * da;
+                    normal += dn * dn;
+                }
+                float const dz = (guides[DEPTH * plane + idx]
+                                  - guides[DEPTH * plane + q]) * zInv;
+
+                float const weight = KERNEL[dx + 2] * KERNEL[dy + 2]
+                    * exp(-min(color * pass.invColor
+                               + albedo * pass.invAlbedo
+                               + normal * pass.invNormal + dz * dz,
+                               MAX_DISTANCE));
+                for (unsigned ch = 0; ch != 3; ++ch)
+                    sum[ch] += weight * in[ch * plane + q];
+                weights += weight;
+            }
+        }
+
+        for (unsigned ch = 0; ch != 3; ++ch)
+            pass.out[ch * plane + idx] = sum[ch] / weights;
+    }
+
+#ifdef __SSE2__
+    // e^x for -MAX_DISTANCE <= x <= 0, to about 1e-4: 2^(x log2 e) split
+    // into a power of two built in the exponent bits and a polynomial for
+    // the fraction
+    __m128 expNegative(__m128 x)
+    {
+        __m128 t = _mm_max_ps(x, _mm_set1_ps(-MAX_DISTANCE));
+        t = _mm_mul_ps(t, _mm_set1_ps(1.44269504f));
+        __m128i const whole = _mm_cvttps_epi32(t);
+        __m128 const f = _mm_sub_ps(t, _mm_cvtepi32_ps(whole));  // (-1, 0]
+
+        __m128 p = _mm_set1_ps(1.33335581e-3f);
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1));
+
+        __m128i const scale = _mm_slli_epi32(
+            _mm_add_epi32(whole, _mm_set1_epi32(127)), 23);
+        return _mm_mul_ps(p, _mm_castsi128_ps(scale));
+    }
+
+    // pixels x ... x + 3, all of whose taps are inside the window along x
+    void filterFour(Pass const &pass, unsigned x, unsigned y)
+    {
+        unsigned const plane = pass.plane;
+        unsigned const idx = y * pass.width + x;
+        float const *in = pass.in;
+        float const *guides = pass.guides;
+
+        __m128 center[3];
+        __m128 albedo[3];
+        __m128 normal[3];
+        for (unsigned ch = 0; ch != 3; ++ch) {
+            center[ch] = _mm_loadu_ps(in + ch * plane + idx);
+            albedo[ch] = _mm_loadu_ps(guides + (ALBEDO + ch) * plane + idx);
+            normal[ch] = _mm_loadu_ps(guides + (NORMAL + ch) * plane + idx);
+        }
+        __m128 const depth = _mm_loadu_ps(guides + DEPTH * plane + idx);
+        __m128 const zInv = _mm_div_ps(_mm_set1_ps(1),
+            _mm_mul_ps(_mm_set1_ps(SIGMA_DEPTH * pass.step),
+                       _mm_max_ps(depth, _mm_set1_ps(1e-9f))));
+        __m128 const invColor = _mm_set1_ps(pass.invColor);
+        __m128 const invAlbedo = _mm_set1_ps(pass.invAlbedo);
+        __m128 const invNormal = _mm_set1_ps(pass.invNormal);
+
+        __m128 sum[3] = { _mm_setzero_ps(), _mm_setzero_ps(),
+                          _mm_setzero_ps() };
+        __m128 weights = _mm_setzero_ps();
+        for (int dy = -2; dy <= 2; ++dy) {
+            int const qy = int(y) + dy * pass.step;
+            if (qy < int(pass.window.y0) || qy >= int(pass.window.y1))
+                continue;
+            for (int dx = -2; dx <= 2; ++dx) {
+                unsigned const q = qy * pass.width + x + dx * pass.step;
+
+                __m128 taps[3];
+                __m128 color = _mm_setzero_ps();
+                __m128 albedoDiff = _mm_setzero_ps();
+                __m128 normalDiff = _mm_setzero_ps();
+                for (unsigned ch = 0; ch != 3; ++ch) {
+                    taps[ch] = _mm_loadu_ps(in + ch * plane + q);
+                    __m128 const dc = _mm_sub_ps(center[ch], taps[ch]);
+                    __m128 const da = _mm_sub_ps(albedo[ch], _mm_loadu_ps(
+                        guides + (ALBEDO + ch) * plane + q));
+                    __m128 const dn = _mm_sub_ps(normal[ch], _mm_loadu_ps(
+                        guides + (NORMAL + ch) * plane + q));
+                    color = _mm_add_ps(color, _mm_mul_ps(dc, dc));
+                    albedoDiff = _mm_add_ps(albedoDiff, _mm_mul_ps(da, da));
+                    normalDiff = _mm_add_ps(normalDiff, _mm_mul_ps(dn, dn));
+                }
+                __m128 const dz = _mm_mul_ps(_mm_sub_ps(depth,
+                    _mm_loadu_ps(guides + DEPTH * plane + q)), zInv);
+
+                __m128 distance = _mm_mul_ps(color, invColor);
+                distance = _mm_add_ps(distance,
+                                      _mm_mul_ps(albedoDiff, invAlbedo));
+                distance = _mm_add_ps(distance,
+                                      _mm_mul_ps(normalDiff, invNormal));
+                distance = _mm_add_ps(distance, _mm_mul_ps(dz, dz));
+                __m128 const weight = _mm_mul_ps(
+                    _mm_set1_ps(KERNEL[dx + 2] * KERNEL[dy + 2]),
+                    expNegative(_mm_sub_ps(_mm_setzero_ps(), distance)));
+
+                for (unsigned ch = 0; ch != 3; ++ch)
+                    sum[ch] = _mm_add_ps(sum[ch], _mm_mul_ps(weight, taps[ch]));
+                weights = _mm_add_ps(weights, weight);
+            }
+        }
+
+        for (unsigned ch = 0; ch != 3; ++ch)
+            _mm_storeu_ps(pass.out + ch * plane + idx,
+                          _mm_div_ps(sum[ch], weights));
+    }
+#endif
+
+    void filterRow(Pass const &pass, unsigned y)
+    {
+        unsigned x = pass.window.x0;
+#ifdef __SSE2__
+        // pixels closer than 2 steps to a side have taps outside the
+        // window, they are done one by one
+        unsigned const reach = 2 * pass.step;
+        for (; x < pass.window.x1 && x < pass.window.x0 + reach; ++x)
+            filterPixel(pass, x, y);
+        for (; x + 4 + reach <= pass.window.x1; x += 4)
+            filterFour(pass, x, y);
+#endif
+        for (; x < pass.window.x1; ++x)
+            filterPixel(pass, x, y);
+    }
+}
+
+void PixelGuide::clear()
+{
+    *this = PixelGuide();
+}
+
+void PixelGuide::add(Color const &color, Vector const &N, double t)
+{
+    albedo += color;
+    normal += N;
+    depth += t;
+    ++samples;
+}
+
+void Denoiser::resize(unsigned width, unsigned height)
+{
+    d_width = width;
+    d_height = height;
+    d_guides.assign(GUIDES * width * height, 0);
+}
+
+void Denoiser::put(unsigned x, unsigned y, PixelGuide const &guide)
+{
+    if (guide.samples == 0)
+        return;
+
+    unsigned const plane = d_width * d_height;
+    unsigned const idx = y * d_width + x;
+    double const scale = 1.0 / guide.samples;
+    for (unsigned ch = 0; ch != 3; ++ch) {
+        d_guides[(ALBEDO + ch) * plane + idx] = guide.albedo.data[ch] * scale;
+        d_guides[(NORMAL + ch) * plane + idx] = guide.normal.data[ch] * scale;
+    }
+    d_guides[DEPTH * plane + idx] = guide.depth * scale;
+}
+
+void Denoiser::filter(Image &img, CropWindow const &window,
+                      ThreadPool &pool) const
+{
+    unsigned const plane = d_width * d_height;
+    if (window.x0 >= window.x1 || window.y0 >= window.y1)
+        return;
+
+    // ping-pong between two copies of the colour planes
+    vector<float> buffers[2];
+    buffers[0].resize(3 * plane);
+    buffers[1].resize(3 * plane);
+    for (unsigned y = window.y0; y != window.y1; ++y) {
+        Image::Row row = img.row(y);
+        float *const channels[3] = { row.r, row.g, row.b };
+        for (unsigned ch = 0; ch != 3; ++ch)
+            copy(channels[ch] + window.x0, channels[ch] + window.x1,
+                 &buffers[0][ch * plane + y * d_width + window.x0]);
+    }
+
+    unsigned const rows = window.y1 - window.y0;
+    for (unsigned idx = 0; idx != PASSES; ++idx) {
+        float const sigmaColor = SIGMA_COLOR / (1 << idx);
+        Pass const pass{ buffers[idx % 2].data(),
+                         buffers[(idx + 1) % 2].data(), d_guides.data(),
+                         plane, d_width, window, 1 << idx,
+                         1 / (sigmaColor * sigmaColor),
+                         1 / (SIGMA_ALBEDO * SIGMA_ALBEDO),
+                         1 / (SIGMA_NORMAL * SIGMA_NORMAL) };
+
+        atomic<unsigned> next(0);
+        pool.run([&](unsigned) {
+            for (unsigned first = next.fetch_add(ROWS); first < rows;
+                 first = next.fetch_add(ROWS))
+            {
+                unsigned const last = min(first + ROWS, rows);
+                for (unsigned y = first; y != last; ++y)
+                    filterRow(pass, window.y0 + y);
+            }
+        });
+    }
+
+    float const *result = buffers[PASSES % 2].data();
+    for (unsigned y = window.y0; y != window.y1; ++y) {
+        Image::Row row = img.row(y);
+        float *const channels[3] = { row.r, row.g, row.b };
+        for (unsigned ch = 0; ch != 3; ++ch) {
+            float const *first = result + ch * plane + y * d_width;
+            copy(first + window.x0, first + window.x1,
+                 channels[ch] + window.x0);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef DENOISER_H_
+#define DENOISER_H_
+
+#include "triple.h"
+
+#include <vector>
+
+class Image;
+class ThreadPool;
+struct CropWindow;
+
+// what the camera rays of a pixel first hit, summed over its subsamples;
+// rays that hit nothing add zeros
+struct PixelGuide
+{
+    Color albedo;
+    Vector normal;
+    double depth = 0;
+    unsigned samples = 0;
+
+    void clear();
+    void add(Color const &albedo, Vector const &normal, double depth);
+};
+
+// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010). Every pass
+// averages each pixel with 5x5 taps spaced 1, 2, 4, ... pixels apart,
+// weighted by a B3 spline and by how similar the taps' colour, albedo,
+// normal and depth are to the pixel's, so noise is smoothed within a
+// surface but edges and texture stay sharp. The guides are per pixel
+// planes like the image's, a pass works on 4 pixels of a row at once.
+class Denoiser
+{
+    unsigned d_width = 0;
+    unsigned d_height = 0;
+    std::vector<float> d_guides;        // GUIDES planes
+
+    public:
+        static unsigned const PASSES = 5;
+
+        // guide buffers for an image of this size, all zero
+        void resize(unsigned width, unsigned height);
+
+        // average of the samples in guide
+        void put(unsigned x, unsigned y, PixelGuide const &guide);
+
+        // filter the pixels inside window, using only pixels inside it
+        void filter(Image &img, CropWindow const &window,
+                    ThreadPool &pool) const;
+};
+
+#endif
@@ -0,0 +1,21 @@
+#include "filetime.h"
+
+#include <sys/stat.h>
+
+using namespace std;
+
+long long modificationTime(string const &filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return 0;
+    return info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+long long fileSize(string const &filename)
+{
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0)
+        return 0;
+    return info.st_size;
+}
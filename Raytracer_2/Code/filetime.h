@@ -0,0 +1,12 @@
+#ifndef FILETIME_H_
+#define FILETIME_H_
+
+#include <string>
+
+// modification time in nanoseconds, 0 if the file cannot be read
+long long modificationTime(std::string const &filename);
+
+// size in bytes, 0 if the file cannot be read
+long long fileSize(std::string const &filename);
+
+#endif
@@ -0,0 +1,159 @@
+#include "grid.h"
+
+#include "object.h"
+#include "shapes/sphere.h"
+
+using namespace std;
+
+namespace
+{
+    int const MAX_DIM = 256;        // cells along an axis
+    double const LARGE = 16;        // large: this many times the median size
+
+    double diagonal(BBox const &box)
+    {
+        return (box.max - box.min).length();
+    }
+}
+
+void Grid::clear()
+{
+    d_box = BBox();
+    fill(d_dims, d_dims + 3, 0);
+    d_cellStart.clear();
+    d_items.clear();
+    d_blockStart.clear();
+    d_spheres.clear();
+    d_large.clear();
+}
+
+void Grid::build(vector<Object *> const &objects, double density,
+    bool batchSpheres)
+{
+    clear();
+    if (objects.empty())
+        return;
+
+    vector<BBox> boxes;
+    vector<double> sizes;
+    for (Object *object : objects) {
+        boxes.push_back(object->bounds());
+        sizes.push_back(diagonal(boxes.back()));
+    }
+    vector<double> sorted(sizes);
+    nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2,
+                sorted.end());
+    double const median = sorted[sorted.size() / 2];
+
+    vector<unsigned> small;
+    for (unsigned idx = 0; idx != objects.size(); ++idx) {
+        if (boxes[idx].empty() || !isfinite(sizes[idx])
+            || sizes[idx] > LARGE * median)
+        {
+            d_large.push_back(objects[idx]);
+        } else {
+            small.push_back(idx);
+            d_box.extend(boxes[idx]);
+        }
+    }
+    if (small.empty())
+        return;
+
+    // cubic cells, about density per object. Boxes are grown a little,
+    // so rounding never drops an object from a cell the ray passes.
+    Vector extent = d_box.max - d_box.min;
+    double const pad = 1e-6 * extent.length() + 1e-9;
+    d_box.min -= pad;
+    d_box.max += pad;
+    extent = d_box.max - d_box.min;
+
+    // a flat box still gets cells along its other axes
+    double const longest = max(extent.x, max(extent.y, extent.z));
+    double volume = 1;
+    for (int axis = 0; axis != 3; ++axis)
+        volume *= max(extent.data[axis], longest / MAX_DIM);
+    double const perUnit = cbrt(density * small.size() / volume);
+    unsigned cells = 1;
+    for (int axis = 0; axis != 3; ++axis) {
+        double const dim = round(extent.data[axis] * perUnit);
+        d_dims[axis] = max(1, int(min<double>(MAX_DIM, dim)));
+        d_cellSize[axis] = extent.data[axis] / d_dims[axis];
+        cells *= d_dims[axis];
+    }
+
+    // cells overlapped by each box, counted first and then filled in
+    auto range = [&](BBox const &box, int lo[3], int hi[3]) {
+        for (int axis = 0; axis != 3; ++axis) {
+            double const origin = d_box.min.data[axis];
+            lo[axis] = floor((box.min.data[axis] - pad - origin)
+                             / d_cellSize[axis]);
+            hi[axis] = floor((box.max.data[axis] + pad - origin)
+                             / d_cellSize[axis]);
+            lo[axis] = max(0, min(d_dims[axis] - 1, lo[axis]));
+            hi[axis] = max(0, min(d_dims[axis] - 1, hi[axis]));
+        }
+    };
+
+    d_cellStart.assign(cells + 1, 0);
+    for (int pass = 0; pass != 2; ++pass) {
+        for (unsigned idx : small) {
+            int lo[3];
+            int hi[3];
+            range(boxes[idx], lo, hi);
+            for (int z = lo[2]; z <= hi[2]; ++z)
+                for (int y = lo[1]; y <= hi[1]; ++y)
+                    for (int x = lo[0]; x <= hi[0]; ++x) {
+                        unsigned const cell = (z * d_dims[1] + y)
+                            * d_dims[0] + x;
+                        if (pass == 0)
+                            ++d_cellStart[cell + 1];
+                        else
+                            d_items[d_cellStart[cell]++] = objects[idx];
+                    }
+        }
+
+        if (pass == 0) {
+            for (unsigned cell = 0; cell != cells; ++cell)
+                d_cellStart[cell + 1] += d_cellStart[cell];
+            d_items.resize(d_cellStart[cells]);
+        } else {
+            // filling moved every start to the next cell's start
+            for (unsigned cell = cells; cell != 0; --cell)
+                d_cellStart[cell] = d_cellStart[cell - 1];
+            d_cellStart[0] = 0;
+        }
+    }
+
+    // move every cell's spheres to blocks of their own
+    d_blockStart.assign(cells + 1, 0);
+    if (!batchSpheres)
+        return;
+
+    vector<Object *> items;
+    uint32_t begin = 0;
+    for (unsigned cell = 0; cell != cells; ++cell) {
+        uint32_t const end = d_cellStart[cell + 1];
+        for (uint32_t item = begin; item != end; ++item) {
+            Object *object = d_items[item];
+            if (Sphere *sphere = dynamic_cast<Sphere *>(object))
+                d_spheres.add(sphere, object->id);
+            else
+                items.push_back(object);
+        }
+        d_spheres.endBlock();
+        begin = end;
+        d_cellStart[cell + 1] = items.size();
+        d_blockStart[cell + 1] = d_spheres.blocks();
+    }
+    d_items.swap(items);
+}
+
+SphereBatch const &Grid::spheres() const
+{
+    return d_spheres;
+}
+
+unsigned Grid::cells() const
+{
+    return d_cellStart.empty() ? 0 : d_cellStart.size() - 1;
+}
@@ -0,0 +1,145 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include "bbox.h"
+#include "ray.h"
+#include "shapes/spherebatch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+class Object;
+
+// Uniform grid over the objects of a scene. Every cell lists the objects
+// whose box overlaps it, and a ray walks the cells it passes through in
+// order (3D-DDA). Building takes linear time, and for many objects of
+// about the same size spread evenly (particles) the walk beats a tree.
+//
+// Objects much larger than the typical one would make every cell they
+// overlap crowded and the grid's box huge, they are kept in a list that
+// every ray tests.
+//
+// With batching, the spheres of every cell are packed into blocks of a
+// SphereBatch instead of listed, and tested 4 at a time.
+class Grid
+{
+    BBox d_box;                         // of the cells
+    int d_dims[3] = { 0, 0, 0 };
+    double d_cellSize[3];
+    std::vector<uint32_t> d_cellStart;  // per cell into d_items, plus end
+    std::vector<Object *> d_items;
+    std::vector<uint32_t> d_blockStart; // per cell into d_spheres, plus end
+    SphereBatch d_spheres;
+    std::vector<Object *> d_large;
+
+    public:
+        void clear();
+
+        // about density cells per object; objects are indexed by their id
+        void build(std::vector<Object *> const &objects, double density,
+                   bool batchSpheres);
+
+        unsigned cells() const;
+        SphereBatch const &spheres() const;
+
+        // calls cell(objects, count, firstBlock, lastBlock) for the large
+        // objects and then for every non-empty cell the ray passes before
+        // tMax, nearest first; the blocks are of spheres(). cell may lower
+        // tMax. An object in several cells is reported for each of them.
+        template <typename Cell>
+        void traverse(Ray const &ray, double const &tMax,
+                      Cell const &cell) const;
+};
+
+template <typename Cell>
+void Grid::traverse(Ray const &ray, double const &tMax,
+                    Cell const &cell) const
+{
+    if (!d_large.empty())
+        cell(d_large.data(), d_large.size(), 0u, 0u);
+    if (d_cellStart.empty())
+        return;
+
+    // where the ray is inside the grid's box
+    double tEnter = 0;
+    double tExit = std::numeric_limits<double>::infinity();
+    for (int axis = 0; axis != 3; ++axis) {
+        double const O = ray.O.data[axis];
+        double const D = ray.D.data[axis];
+        if (D == 0) {
+            if (O < d_box.min.data[axis] || O > d_box.max.data[axis])
+                return;
+            continue;
+        }
+
+        double t0 = (d_box.min.data[axis] - O) / D;
+        double t1 = (d_box.max.data[axis] - O) / D;
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tEnter = std::max(tEnter, t0);
+        tExit = std::min(tExit, t1);
+    }
+    if (tEnter > tExit || tEnter > tMax)
+        return;
+
+    // current cell, distance to its next boundary and between boundaries
+    // per axis
+    int pos[3];
+    int step[3];
+    double next[3];
+    double delta[3];
+    for (int axis = 0; axis != 3; ++axis) {
+        double const O = ray.O.data[axis];
+        double const D = ray.D.data[axis];
+        double const min = d_box.min.data[axis];
+        double const size = d_cellSize[axis];
+
+        pos[axis] = std::floor((O + tEnter * D - min) / size);
+        pos[axis] = std::max(0, std::min(d_dims[axis] - 1, pos[axis]));
+
+        if (D > 0) {
+            step[axis] = 1;
+            next[axis] = (min + (pos[axis] + 1) * size - O) / D;
+            delta[axis] = size / D;
+        } else if (D < 0) {
+            step[axis] = -1;
+            next[axis] = (min + pos[axis] * size - O) / D;
+            delta[axis] = -size / D;
+        } else {
+            step[axis] = 0;
+            next[axis] = std::numeric_limits<double>::infinity();
+            delta[axis] = 0;
+        }
+    }
+
+    while (true) {
+        unsigned const idx = (pos[2] * d_dims[1] + pos[1]) * d_dims[0]
+            + pos[0];
+        unsigned const first = d_cellStart[idx];
+        unsigned const firstBlock = d_blockStart[idx];
+        if (d_cellStart[idx + 1] != first
+            || d_blockStart[idx + 1] != firstBlock)
+        {
+            cell(d_items.data() + first, d_cellStart[idx + 1] - first,
+                 firstBlock, unsigned(d_blockStart[idx + 1]));
+        }
+
+        int axis = next[0] < next[1] ? 0 : 1;
+        if (next[2] < next[axis])
+            axis = 2;
+
+        // the next cell starts after anything found so far
+        if (next[axis] > tMax || next[axis] > tExit)
+            return;
+
+        pos[axis] += step[axis];
+        if (pos[axis] < 0 || pos[axis] >= d_dims[axis])
+            return;
+        next[axis] += delta[axis];
+    }
+}
+
+#endif
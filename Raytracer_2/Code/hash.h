@@ -0,0 +1,37 @@
+#ifndef HASH_H_
+#define HASH_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// 64 bit FNV-1a hash of everything added, for cache keys
+class Hash
+{
+    uint64_t d_value = 0xCBF29CE484222325ULL;
+
+    public:
+        void add(void const *data, size_t size)
+        {
+            unsigned char const *bytes =
+                static_cast<unsigned char const *>(data);
+            for (size_t idx = 0; idx != size; ++idx)
+            {
+                d_value ^= bytes[idx];
+                d_value *= 0x100000001B3ULL;
+            }
+        }
+
+        // plain data only
+        template <typename Type>
+        void add(Type const &value)
+        {
+            add(&value, sizeof value);
+        }
+
+        uint64_t value() const
+        {
+            return d_value;
+        }
+};
+
+#endif
@@ -16,13 +16,12 @@ class Hit
             N(normal)
         {}
 
-        static Hit const NO_HIT()
+        // built in place: a function local static would be guarded by
+        // an atomic check on every miss
+        static Hit NO_HIT()
         {
-            static Hit no_hit(std::numeric_limits<double>::quiet_NaN(),
-                              Vector(std::numeric_limits<double>::quiet_NaN(),
-                                     std::numeric_limits<double>::quiet_NaN(),
-                                     std::numeric_limits<double>::quiet_NaN()));
-            return no_hit;
+            double const nan = std::numeric_limits<double>::quiet_NaN();
+            return Hit(nan, Vector(nan, nan, nan));
         }
 };
 
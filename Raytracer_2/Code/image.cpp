@@ -1,99 +1,226 @@
 #include "image.h"
 
+#include "timeline.h"
+
 #include "lode/lodepng.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
+namespace
+{
+    // linear values [0, 1] in LUT_SIZE steps to sRGB encoded bytes. Fine
+    // enough that decoding a byte and encoding it again gives that byte.
+    unsigned const LUT_SIZE = 1 << 12;
+
+    double encodeSRGB(double linear)
+    {
+        return linear <= 0.0031308 ? 12.92 * linear
+                                   : 1.055 * pow(linear, 1 / 2.4) - 0.055;
+    }
+
+    double decodeSRGB(double encoded)
+    {
+        return encoded <= 0.04045 ? encoded / 12.92
+                                  : pow((encoded + 0.055) / 1.055, 2.4);
+    }
+
+    struct SRGBTable
+    {
+        unsigned char bytes[LUT_SIZE];
+
+        SRGBTable()
+        {
+            for (unsigned idx = 0; idx != LUT_SIZE; ++idx)
+                bytes[idx] = static_cast<unsigned char>(
+                    encodeSRGB(idx / double(LUT_SIZE - 1)) * 255 + 0.5);
+        }
+    };
+
+    SRGBTable const &srgbTable()
+    {
+        static SRGBTable const table;
+        return table;
+    }
+
+    float clamp01(float value)
+    {
+        // also maps NaN to 0
+        return value > 0 ? (value < 1 ? value : 1) : 0;
+    }
+
+    unsigned char quantize(float value, unsigned char const *lut)
+    {
+        value = clamp01(value);
+        if (lut)
+            return lut[static_cast<unsigned>(value * (LUT_SIZE - 1) + 0.5f)];
+        return static_cast<unsigned char>(value * 255 + 0.5f);
+    }
+}
+
 Image::Image(unsigned width, unsigned height)
 :
-    d_pixels(width * height),
+    d_planes(3 * width * height),
     d_width(width),
     d_height(height)
 {}
 
-Image::Image(string const &filename)
+Image::Image(string const &filename, bool srgb)
 {
     read_png(filename);
+    if (srgb) {
+        float decoded[256];
+        for (unsigned idx = 0; idx != 256; ++idx)
+            decoded[idx] = decodeSRGB(idx / 255.0);
+        for (float &value : d_planes)
+            value = decoded[static_cast<unsigned>(value * 255 + 0.5f)];
+        d_srgb = true;
+    }
 }
 
 // normal accessors
 void Image::put_pixel(unsigned x, unsigned y, Color const &c)
 {
-    (*this)(x, y) = c;
+    check(x, y);
+    row(y).put(x, c);
 }
 Color Image::get_pixel(unsigned x, unsigned y) const
 {
+    check(x, y);
     return (*this)(x, y);
 }
 
-// Handier accessors
-// Usage: color = img(x,y);
-//        img(x,y) = color;
-Color const&Image::operator()(unsigned x, unsigned y) const
+unsigned Image::width() const
 {
-    return d_pixels.at(index(x, y));
+    return d_width;
 }
-Color &Image::operator()(unsigned x, unsigned y)
+
+unsigned Image::height() const
 {
-    return d_pixels.at(index(x, y));
+    return d_height;
 }
 
-unsigned Image::width() const
+// Normalized accessors, unsignederval is (0...1, 0...1)
+// usefull for texture access
+Color Image::colorAt(float x, float y) const
 {
-    return d_width;
+    unsigned const idx = findex(x, y);
+    return (*this)(idx % d_width, idx / d_width);
 }
 
-unsigned Image::height() const
+void Image::setSRGB(bool srgb)
 {
-    return d_height;
+    d_srgb = srgb;
 }
 
-unsigned Image::size() const
+bool Image::srgb() const
 {
-    return d_width * d_height;
+    return d_srgb;
 }
 
-// Normalized accessors, unsignederval is (0...1, 0...1)
-// usefull for texture access
-Color const &Image::colorAt(float x, float y) const
+void Image::resolve(unsigned char *rgba) const
 {
-    return d_pixels.at(findex(x, y));
+    unsigned const plane = size();
+    float const *red = d_planes.data();
+    float const *green = red + plane;
+    float const *blue = green + plane;
+    unsigned char const *lut = d_srgb ? srgbTable().bytes : nullptr;
+
+    unsigned idx = 0;
+#ifdef __SSE2__
+    // 4 pixels at a time: clamp, then either round to 8 bits or round to
+    // a table index, and pack the channels with an opaque alpha
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps(1);
+    __m128 const half = _mm_set1_ps(0.5f);
+    __m128 const scale = _mm_set1_ps(lut ? LUT_SIZE - 1 : 255);
+    __m128i const alpha = _mm_set1_epi32(0xff000000);
+
+    for (; idx + 4 <= plane; idx += 4) {
+        __m128i channel[3];
+        float const *planes[3] = { red, green, blue };
+        for (int ch = 0; ch != 3; ++ch) {
+            // max first, so NaN becomes 0
+            __m128 value = _mm_max_ps(_mm_loadu_ps(planes[ch] + idx), zero);
+            value = _mm_min_ps(value, one);
+            channel[ch] = _mm_cvttps_epi32(
+                _mm_add_ps(_mm_mul_ps(value, scale), half));
+        }
+
+        if (lut) {
+            alignas(16) int32_t index[3][4];
+            for (int ch = 0; ch != 3; ++ch) {
+                _mm_store_si128(reinterpret_cast<__m128i *>(index[ch]),
+                                channel[ch]);
+                channel[ch] = _mm_setr_epi32(lut[index[ch][0]],
+                    lut[index[ch][1]], lut[index[ch][2]], lut[index[ch][3]]);
+            }
+        }
+
+        __m128i const pixels = _mm_or_si128(
+            _mm_or_si128(channel[0], _mm_slli_epi32(channel[1], 8)),
+            _mm_or_si128(_mm_slli_epi32(channel[2], 16), alpha));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(rgba + 4 * idx),
+                         pixels);
+    }
+#endif
+    for (; idx != plane; ++idx) {
+        rgba[4 * idx] = quantize(red[idx], lut);
+        rgba[4 * idx + 1] = quantize(green[idx], lut);
+        rgba[4 * idx + 2] = quantize(blue[idx], lut);
+        rgba[4 * idx + 3] = 255;    // alpha is always 1
+    }
 }
 
 void Image::write_png(std::string const &filename) const
 {
-    vector<unsigned char> image;
-    image.reserve(size() * 4);  // reserves size (less allocations)
-    for (Color pixel : d_pixels)
-    {
-        image.push_back(static_cast<unsigned char>(pixel.r * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.g * 255.0));
-        image.push_back(static_cast<unsigned char>(pixel.b * 255.0));
-        image.push_back(255);   // alpha is always 1
-    }
+    vector<unsigned char> png;
+    encode_png(png);
+    lodepng::save_file(png, filename);
+}
 
-    lodepng::encode(filename, image, d_width, d_height);
+void Image::encode_png(std::vector<unsigned char> &png) const
+{
+    Timeline::Scope const event("encode");
+    vector<unsigned char> image(size() * 4);
+    resolve(image.data());
+    lodepng::encode(png, image, d_width, d_height);
 }
 
 void Image::read_png(std::string const &filename)
 {
     vector<unsigned char> image;
-    lodepng::decode(image, d_width, d_height, filename);
-    d_pixels.reserve(size());
+    unsigned width = 0;
+    unsigned height = 0;
+    if (unsigned error = lodepng::decode(image, width, height, filename))
+        throw runtime_error("Could not read " + filename + ": "
+                            + lodepng_error_text(error) + '.');
+    d_width = width;
+    d_height = height;
+    d_planes.resize(3 * size());
 
-    auto imgIter = image.begin();
-    while (imgIter != image.end())
+    float *red = d_planes.data();
+    float *green = red + size();
+    float *blue = green + size();
+    for (unsigned idx = 0; idx != size(); ++idx)
     {
-        double r = (*imgIter) / 255.0;
-        ++imgIter;
-        double g = (*imgIter) / 255.0;
-        ++imgIter;
-        double b = (*imgIter) / 255.0;
-        ++imgIter;
+        red[idx] = image[4 * idx] / 255.0f;
+        green[idx] = image[4 * idx + 1] / 255.0f;
+        blue[idx] = image[4 * idx + 2] / 255.0f;
         // Ignore Alpha
-        ++imgIter;
-        d_pixels.push_back(Color(r, g, b));
     }
 }
+
+void Image::check(unsigned x, unsigned y) const
+{
+    if (x >= d_width || y >= d_height)
+        throw out_of_range("Pixel outside the image.");
+}
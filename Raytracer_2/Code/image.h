@@ -6,25 +6,45 @@
 #include <string>
 #include <vector>
 
+// Pixels are kept as 32-bit floats, one plane per channel (all red values,
+// then all green, then all blue), so the resolve to 8 bits works on 4
+// pixels at a time.
 class Image
 {
-    std::vector<Color> d_pixels;
-    unsigned d_width;
-    unsigned d_height;
+    std::vector<float> d_planes;
+    unsigned d_width = 0;
+    unsigned d_height = 0;
+    bool d_srgb = false;        // files hold sRGB encoded values
 
     public:
+        // unchecked access to one row, for the renderer
+        struct Row
+        {
+            float *r;
+            float *g;
+            float *b;
+
+            void put(unsigned x, Color const &c)
+            {
+                r[x] = c.r;
+                g[x] = c.g;
+                b[x] = c.b;
+            }
+        };
+
         Image(unsigned width = 0, unsigned height = 0);
-        Image(std::string const &filename);
+        // an sRGB file is decoded to linear values
+        Image(std::string const &filename, bool srgb = false);
 
-        // normal accessors
+        // normal accessors, checked
         void put_pixel(unsigned x, unsigned y, Color const &c);
         Color get_pixel(unsigned x, unsigned y) const;
 
-        // Handier accessors
+        // Handier accessor, unchecked
         // Usage: color = img(x,y);
-        //        img(x,y) = color;
-        Color const &operator()(unsigned x, unsigned y) const;
-        Color &operator()(unsigned x, unsigned y);
+        Color operator()(unsigned x, unsigned y) const;
+
+        Row row(unsigned y);
 
         unsigned width() const;
         unsigned height() const;
@@ -32,9 +52,17 @@ class Image
 
         // Normalized accessors, unsignederval is (0...1, 0...1)
         // usefull for texture access
-        Color const &colorAt(float x, float y) const;
+        Color colorAt(float x, float y) const;
+
+        // encode with the sRGB curve when writing
+        void setSRGB(bool srgb);
+        bool srgb() const;
+
+        // clamp, encode and quantize to 8-bit RGBA, size() * 4 bytes
+        void resolve(unsigned char *rgba) const;
 
         void write_png(std::string const &filename) const;
+        void encode_png(std::vector<unsigned char> &png) const;
         void read_png(std::string const &filename);
 
     private:
@@ -50,6 +78,26 @@ class Image
                 static_cast<unsigned>(y * (d_height - 1)));
         }
 
+        void check(unsigned x, unsigned y) const;
 };
 
+inline Color Image::operator()(unsigned x, unsigned y) const
+{
+    unsigned const idx = index(x, y);
+    unsigned const plane = size();
+    return Color(d_planes[idx], d_planes[plane + idx],
+                 d_planes[2 * plane + idx]);
+}
+
+inline Image::Row Image::row(unsigned y)
+{
+    float *first = d_planes.data() + index(0, y);
+    return Row{ first, first + size(), first + 2 * size() };
+}
+
+inline unsigned Image::size() const
+{
+    return d_width * d_height;
+}
+
 #endif
@@ -0,0 +1,70 @@
+#include "light.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+Light::Light(Point const &pos, Color const &c, Vector const &e1,
+             Vector const &e2, double r, unsigned n)
+:
+    position(pos),
+    color(c),
+    edge1(e1),
+    edge2(e2),
+    radius(r),
+    strata(max(n, 1u))
+{}
+
+Light Light::rectangle(Point const &center, Vector const &edge1,
+                       Vector const &edge2, Color const &c, unsigned strata)
+{
+    return Light(center, c, edge1, edge2, 0, strata);
+}
+
+Light Light::sphere(Point const &center, double radius, Color const &c,
+                    unsigned strata)
+{
+    return Light(center, c, Vector(), Vector(), radius, strata);
+}
+
+bool Light::isArea() const
+{
+    return radius > 0 || edge1.length_2() > 0 || edge2.length_2() > 0;
+}
+
+double Light::extent() const
+{
+    return max(radius, 0.5 * (edge1.length() + edge2.length()));
+}
+
+Point Light::sample(Point const &from, double u, double v) const
+{
+    if (radius == 0)
+        return position + (u - 0.5) * edge1 + (v - 0.5) * edge2;
+
+    // a sphere looks like a disc facing the point. The square maps onto
+    // it concentrically (Shirley and Chiu), so strata stay compact and
+    // its corners go to the rim.
+    double const a = 2 * u - 1;
+    double const b = 2 * v - 1;
+    double r;
+    double phi;
+    if (a == 0 && b == 0) {
+        r = 0;
+        phi = 0;
+    } else if (fabs(a) > fabs(b)) {
+        r = a;
+        phi = M_PI / 4 * b / a;
+    } else {
+        r = b;
+        phi = M_PI / 2 - M_PI / 4 * a / b;
+    }
+
+    Vector const w = (position - from).normalized();
+    Vector const helper = fabs(w.x) > 0.9 ? Vector(0, 1, 0)
+                                          : Vector(1, 0, 0);
+    Vector const s = w.cross(helper).normalized();
+    Vector const t = w.cross(s);
+    return position + radius * r * (cos(phi) * s + sin(phi) * t);
+}
@@ -3,22 +3,46 @@
 
 #include "triple.h"
 
-// Declare LightPtr for use in Scene class
-#include <memory>
-class Light;
-typedef std::shared_ptr<Light> LightPtr;
-
+// A point light, or an area light: a rectangle spanned by two edges
+// centred on position, or a sphere around it. Area lights shade like a
+// point light at position, scaled by how much of them a point sees; that
+// is estimated with shadow rays to strata x strata cells of the light.
 class Light
 {
     public:
         Point const position;
         Color const color;
+        Vector const edge1;         // rectangle, both zero otherwise
+        Vector const edge2;
+        double const radius;        // sphere, 0 otherwise
+        unsigned const strata;      // per side, for area lights
 
         Light(Point const &pos, Color const &c)
         :
             position(pos),
-            color(c)
+            color(c),
+            radius(0),
+            strata(1)
         {}
+
+        static Light rectangle(Point const &center, Vector const &edge1,
+                               Vector const &edge2, Color const &c,
+                               unsigned strata);
+        static Light sphere(Point const &center, double radius,
+                            Color const &c, unsigned strata);
+
+        bool isArea() const;
+
+        // distance from position to the farthest point of the light
+        double extent() const;
+
+        // point of the light for (u, v) in [0, 1) x [0, 1), spread evenly
+        // over it as seen from point from
+        Point sample(Point const &from, double u, double v) const;
+
+    private:
+        Light(Point const &pos, Color const &c, Vector const &e1,
+              Vector const &e2, double r, unsigned n);
 };
 
 #endif
@@ -0,0 +1,175 @@
+#include "lightbatch.h"
+
+#include "light.h"
+
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace
+{
+    // largest specular exponent raised by squaring
+    double const MAX_INTEGER_EXPONENT = 1 << 16;
+
+#ifdef __SSE2__
+    float sum(__m128 value)
+    {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, value);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    }
+
+    // zero lanes below 1e-18: their squares and products stay normal
+    // numbers (denormals are very slow), and what is dropped would not
+    // show in a specular highlight anyway
+    __m128 flush(__m128 value)
+    {
+        return _mm_and_ps(value, _mm_cmpge_ps(value, _mm_set1_ps(1e-18f)));
+    }
+
+    __m128 power(__m128 base, double exponent)
+    {
+        if (exponent == floor(exponent) && exponent >= 0
+            && exponent <= MAX_INTEGER_EXPONENT)
+        {
+            __m128 result = _mm_set1_ps(1);
+            for (unsigned bits = exponent; bits != 0; bits >>= 1) {
+                if (bits & 1)
+                    result = flush(_mm_mul_ps(result, base));
+                base = flush(_mm_mul_ps(base, base));
+            }
+            return result;
+        }
+
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, base);
+        for (float &lane : lanes)
+            lane = pow(lane, exponent);
+        return _mm_load_ps(lanes);
+    }
+#endif
+}
+
+void LightBatch::clear()
+{
+    d_lights.clear();
+}
+
+void LightBatch::add(Light const &light)
+{
+    float const packed[8] = {
+        float(light.position.x), float(light.position.y),
+        float(light.position.z), 0,
+        float(light.color.r), float(light.color.g), float(light.color.b), 0
+    };
+    d_lights.insert(d_lights.end(), packed, packed + 8);
+}
+
+void LightBatch::shade(Point const &hit, Vector const &N, Vector const &V,
+                       double exponent, unsigned const *lights,
+                       float const *weights, unsigned count, Color &diffuse,
+                       Color &specular) const
+{
+#ifdef __SSE2__
+    __m128 const hx = _mm_set1_ps(hit.x);
+    __m128 const hy = _mm_set1_ps(hit.y);
+    __m128 const hz = _mm_set1_ps(hit.z);
+    __m128 const nx = _mm_set1_ps(N.x);
+    __m128 const ny = _mm_set1_ps(N.y);
+    __m128 const nz = _mm_set1_ps(N.z);
+    __m128 const vx = _mm_set1_ps(V.x);
+    __m128 const vy = _mm_set1_ps(V.y);
+    __m128 const vz = _mm_set1_ps(V.z);
+    __m128 const twoNV = _mm_set1_ps(2 * N.dot(V));
+    __m128 const zero = _mm_setzero_ps();
+
+    __m128 dr = zero;
+    __m128 dg = zero;
+    __m128 db = zero;
+    __m128 sr = zero;
+    __m128 sg = zero;
+    __m128 sb = zero;
+
+    for (unsigned first = 0; first < count; first += WIDTH) {
+        // 4 lights from their packed rows to one register per component;
+        // missing lanes repeat the first light with weight 0
+        alignas(16) float weight[WIDTH];
+        __m128 x, y, z, w, r, g, b, unused;
+        float const *rows[WIDTH];
+        for (unsigned lane = 0; lane != WIDTH; ++lane) {
+            bool const used = first + lane < count;
+            rows[lane] = &d_lights[8 * lights[used ? first + lane : first]];
+            weight[lane] = used ? weights[first + lane] : 0;
+        }
+        x = _mm_loadu_ps(rows[0]);
+        y = _mm_loadu_ps(rows[1]);
+        z = _mm_loadu_ps(rows[2]);
+        unused = _mm_loadu_ps(rows[3]);
+        _MM_TRANSPOSE4_PS(x, y, z, unused);
+        r = _mm_loadu_ps(rows[0] + 4);
+        g = _mm_loadu_ps(rows[1] + 4);
+        b = _mm_loadu_ps(rows[2] + 4);
+        unused = _mm_loadu_ps(rows[3] + 4);
+        _MM_TRANSPOSE4_PS(r, g, b, unused);
+        w = _mm_load_ps(weight);
+
+        // l = (light - hit) / |light - hit|, only its dot products with N
+        // and V are needed: R.V = 2 (N.l) (N.V) - l.V
+        __m128 const lx = _mm_sub_ps(x, hx);
+        __m128 const ly = _mm_sub_ps(y, hy);
+        __m128 const lz = _mm_sub_ps(z, hz);
+        __m128 const inv = _mm_div_ps(_mm_set1_ps(1), _mm_sqrt_ps(
+            _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx), _mm_mul_ps(ly, ly)),
+                       _mm_mul_ps(lz, lz))));
+        __m128 const ln = _mm_mul_ps(inv, _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(lx, nx), _mm_mul_ps(ly, ny)),
+            _mm_mul_ps(lz, nz)));
+        __m128 const lv = _mm_mul_ps(inv, _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(lx, vx), _mm_mul_ps(ly, vy)),
+            _mm_mul_ps(lz, vz)));
+        __m128 const rv = _mm_sub_ps(_mm_mul_ps(twoNV, ln), lv);
+
+        __m128 const lambert = _mm_mul_ps(w, _mm_max_ps(ln, zero));
+        __m128 const highlight = _mm_mul_ps(w,
+            power(_mm_max_ps(rv, zero), exponent));
+
+        dr = _mm_add_ps(dr, _mm_mul_ps(lambert, r));
+        dg = _mm_add_ps(dg, _mm_mul_ps(lambert, g));
+        db = _mm_add_ps(db, _mm_mul_ps(lambert, b));
+        sr = _mm_add_ps(sr, _mm_mul_ps(highlight, r));
+        sg = _mm_add_ps(sg, _mm_mul_ps(highlight, g));
+        sb = _mm_add_ps(sb, _mm_mul_ps(highlight, b));
+    }
+
+    diffuse = Color(sum(dr), sum(dg), sum(db));
+    specular = Color(sum(sr), sum(sg), sum(sb));
+#else
+    shadeScalar(hit, N, V, exponent, lights, weights, count, diffuse,
+                specular);
+#endif
+}
+
+void LightBatch::shadeScalar(Point const &hit, Vector const &N,
+    Vector const &V, double exponent, unsigned const *lights,
+    float const *weights, unsigned count, Color &diffuse,
+    Color &specular) const
+{
+    diffuse = Color();
+    specular = Color();
+    for (unsigned idx = 0; idx != count; ++idx) {
+        float const *row = &d_lights[8 * lights[idx]];
+        Vector l = Point(row[0], row[1], row[2]) - hit;
+        l.normalize();
+        Color const color(row[4], row[5], row[6]);
+
+        double const ln = l.dot(N);
+        double const rv = 2 * ln * N.dot(V) - l.dot(V);
+        diffuse += weights[idx] * fmax(0, ln) * color;
+        specular += weights[idx] * pow(fmax(0, rv), exponent) * color;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef LIGHTBATCH_H_
+#define LIGHTBATCH_H_
+
+#include "triple.h"
+
+#include <vector>
+
+class Light;
+
+// Phong terms of many lights at one hit. Lights are packed in single
+// precision, and 4 of them are shaded at once with SSE: direction,
+// Lambert and specular factors and their sums per colour. An integer
+// specular exponent is raised by repeated squaring, others use pow per
+// light. Results match the scalar formulas to single precision.
+class LightBatch
+{
+    public:
+        static unsigned const WIDTH = 4;
+
+    private:
+        // per light: position x, y, z, 0, colour r, g, b, 0
+        std::vector<float> d_lights;
+
+    public:
+        void clear();
+        void add(Light const &light);
+
+        // sum over lights[0, count) of weight * max(0, N.l) * colour
+        // (diffuse) and weight * max(0, R.V)^exponent * colour (specular),
+        // with l from hit towards the light and R its mirror image about
+        // N. N and V are normalized.
+        void shade(Point const &hit, Vector const &N, Vector const &V,
+                   double exponent, unsigned const *lights,
+                   float const *weights, unsigned count, Color &diffuse,
+                   Color &specular) const;
+
+    private:
+        void shadeScalar(Point const &hit, Vector const &N, Vector const &V,
+                         double exponent, unsigned const *lights,
+                         float const *weights, unsigned count,
+                         Color &diffuse, Color &specular) const;
+};
+
+#endif
@@ -0,0 +1,68 @@
+#include "lightsampler.h"
+
+#include <algorithm>
+
+using namespace std;
+
+void LightSampler::build(vector<double> const &weights)
+{
+    size_t const count = weights.size();
+    d_prob.assign(count, 1.0);
+    d_alias.resize(count);
+    d_pdf.resize(count);
+
+    double total = 0.0;
+    for (double weight : weights)
+        total += max(weight, 0.0);
+
+    for (size_t idx = 0; idx != count; ++idx)
+    {
+        d_alias[idx] = idx;
+        d_pdf[idx] = total > 0.0 ? max(weights[idx], 0.0) / total
+                                 : 1.0 / count;
+    }
+
+    // scaled probabilities, average is 1
+    vector<double> scaled(count);
+    vector<unsigned> small;
+    vector<unsigned> large;
+    for (size_t idx = 0; idx != count; ++idx)
+    {
+        scaled[idx] = d_pdf[idx] * count;
+        (scaled[idx] < 1.0 ? small : large).push_back(idx);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        unsigned less = small.back();
+        small.pop_back();
+        unsigned more = large.back();
+
+        d_prob[less] = scaled[less];
+        d_alias[less] = more;
+
+        scaled[more] -= 1.0 - scaled[less];
+        if (scaled[more] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(more);
+        }
+    }
+    // leftovers are 1 up to rounding errors, keep their default prob of 1
+}
+
+unsigned LightSampler::sample(double u, double &pdf) const
+{
+    double scaled = u * d_prob.size();
+    unsigned bucket = min(static_cast<unsigned>(scaled),
+                          static_cast<unsigned>(d_prob.size() - 1));
+    unsigned idx = (scaled - bucket) < d_prob[bucket] ? bucket
+                                                      : d_alias[bucket];
+    pdf = d_pdf[idx];
+    return idx;
+}
+
+unsigned LightSampler::size() const
+{
+    return d_pdf.size();
+}
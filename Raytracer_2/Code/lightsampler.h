@@ -0,0 +1,24 @@
+#ifndef LIGHTSAMPLER_H_
+#define LIGHTSAMPLER_H_
+
+#include <vector>
+
+// Importance sampling of lights with Vose's alias method: picking a light
+// costs O(1) regardless of the number of lights.
+class LightSampler
+{
+    std::vector<double> d_prob;     // probability of keeping the bucket
+    std::vector<unsigned> d_alias;  // bucket used otherwise
+    std::vector<double> d_pdf;      // normalized weight per light
+
+    public:
+        // weights need not be normalized, all zero means uniform
+        void build(std::vector<double> const &weights);
+
+        // u in [0, 1), returns the light index and its probability
+        unsigned sample(double u, double &pdf) const;
+
+        unsigned size() const;
+};
+
+#endif
@@ -1,44 +1,219 @@
+#include "batchrenderer.h"
 #include "raytracer.h"
+#include "regression.h"
+#include "renderserver.h"
+#include "tasks.h"
+#include "threadpool.h"
+#include "timeline.h"
 
+#include "json/json.h"
+#include "lode/lodepng.h"
+
+#include <climits>
+#include <cstdlib>
 #include <iostream>
 #include <string>
+#include <vector>
 
 using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    void usage(char const *program)
+    {
+        cerr << "Usage: " << program << " [--threads n] [--trace out.json]"
+                " [--watch] in-file [out-file.png]\n"
+             << "       " << program << " [--threads n] --batch"
+                " [--trace out.json] scene-files, globs or lists...\n"
+             << "       " << program << " [--threads n] --daemon socket\n"
+             << "       " << program << " [--threads n] --regress"
+                " manifest.json [--record] [--trace out.json]\n"
+             << "       " << program << " --client socket [--eye x,y,z]"
+                " [--size wxh] [--samples n] in-file [out-file.png]\n";
+    }
+
+    // "1,2,3" or "640x480" -> json array of numbers
+    json numbers(string const &text)
+    {
+        json array = json::array();
+        size_t start = 0;
+        while (start <= text.size())
+        {
+            size_t end = text.find_first_of(",x", start);
+            if (end == string::npos)
+                end = text.size();
+            array.push_back(stod(text.substr(start, end - start)));
+            start = end + 1;
+        }
+        return array;
+    }
+
+    // writes the timeline once the threads that record it are gone
+    class TimelineWriter
+    {
+        string d_filename;
+
+        public:
+            explicit TimelineWriter(string const &filename)
+            :
+                d_filename(filename)
+            {
+                if (d_filename.empty())
+                    return;
+                Timeline::enable();
+                Timeline::nameThread("main");
+            }
+
+            ~TimelineWriter()
+            {
+                if (d_filename.empty())
+                    return;
+                if (Timeline::write(d_filename))
+                    cout << "Timeline written to " << d_filename << ".\n";
+                else
+                    cerr << "Error: cannot write " << d_filename << ".\n";
+            }
+    };
+
+    // send the job to the daemon and save the image it returns
+    int renderRemote(string const &socketPath, json job, string const &ifname,
+                     string const &ofname)
+    {
+        // the daemon may run in another directory
+        char path[PATH_MAX];
+        if (!realpath(ifname.c_str(), path))
+        {
+            cerr << "Error: cannot find " << ifname << ".\n";
+            return 1;
+        }
+        job["scene"] = path;
+
+        vector<unsigned char> png;
+        string error;
+        if (!requestRender(socketPath, job, png, error))
+        {
+            cerr << "Error: " << error << ".\n";
+            return 1;
+        }
+
+        cout << "Writing image to " << ofname << "...\n";
+        lodepng::save_file(png, ofname);
+        cout << "Done.\n";
+        return 0;
+    }
+}
 
 int main(int argc, char *argv[])
 {
     cout << "Introduction to Computer Graphics - Raytracer\n\n";
 
-    if (argc < 2 || argc > 3)
+    // split options from file names
+    bool watch = false;
+    bool batch = false;
+    bool record = false;            // store new regression timings
+    unsigned threads = 0;           // one per hardware thread
+    string daemonSocket;
+    string clientSocket;
+    string manifest;
+    string traceFile;               // Chrome trace of the render
+    json job = json::object();     // overrides sent by the client
+    vector<string> files;
+    for (int idx = 1; idx < argc; ++idx)
     {
-        cerr << "Usage: " << argv[0] << "in-file [out-file.png]\n";
-        return 1;
+        string const arg = argv[idx];
+        bool const hasValue = idx + 1 < argc;
+
+        if (arg == "--watch")
+            watch = true;
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg == "--threads" && hasValue)
+            threads = stoi(argv[++idx]);
+        else if (arg == "--daemon" && hasValue)
+            daemonSocket = argv[++idx];
+        else if (arg == "--regress" && hasValue)
+            manifest = argv[++idx];
+        else if (arg == "--trace" && hasValue)
+            traceFile = argv[++idx];
+        else if (arg == "--record")
+            record = true;
+        else if (arg == "--client" && hasValue)
+            clientSocket = argv[++idx];
+        else if (arg == "--eye" && hasValue)
+            job["eye"] = numbers(argv[++idx]);
+        else if (arg == "--size" && hasValue)
+            job["size"] = numbers(argv[++idx]);
+        else if (arg == "--samples" && hasValue)
+            job["samples"] = stoi(argv[++idx]);
+        else if (arg.compare(0, 2, "--") == 0)
+        {
+            usage(argv[0]);
+            return 1;
+        }
+        else
+            files.push_back(arg);
     }
 
-    Raytracer raytracer;
+    if (!clientSocket.empty() && (files.size() == 1 || files.size() == 2))
+        return renderRemote(clientSocket, job, files[0],
+                            files.size() == 2 ? files[1]
+                                : Raytracer::outputName(files[0]));
 
-    // read the scene
-    if (!raytracer.readScene(argv[1]))
+    TimelineWriter const timeline(traceFile);
+
+    // created once, shared by every frame rendered by this process
+    ThreadPool pool(threads);
+    Tasks::setThreads(pool.size());     // for building meshes
+
+    if (!daemonSocket.empty())
     {
-        cerr << "Error: reading scene from " << argv[1] <<
-            " failed - no output generated.\n";
+        RenderServer server(daemonSocket, pool);
+        return server.run() ? 0 : 1;    // only returns on failure
+    }
+
+    if (!manifest.empty())
+    {
+        Regression regression(manifest, pool);
+        return regression.run(record) ? 0 : 1;
+    }
+
+    if (batch)
+    {
+        BatchRenderer renderer(pool);
+        return renderer.render(BatchRenderer::expand(files)) == 0 ? 0 : 1;
+    }
+
+    if (files.size() < 1 || files.size() > 2)
+    {
+        usage(argv[0]);
         return 1;
     }
 
+    Raytracer raytracer;
+
     // determine output name
     string ofname;
-    if (argc >= 3)
+    if (files.size() >= 2)
+        ofname = files[1];  // use the provided name
+    else
+        ofname = Raytracer::outputName(files[0]);   // .json -> .png
+
+    if (watch)
     {
-        ofname = argv[2];   // use the provided name
+        raytracer.watch(files[0], ofname, pool);   // does not return
+        return 0;
     }
-    else
+
+    // read the scene
+    if (!raytracer.readScene(files[0]))
     {
-        ofname = argv[1];   // replace .json with .png
-        ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
-        ofname += ".png";
+        cerr << "Error: reading scene from " << files[0] <<
+            " failed - no output generated.\n";
+        return 1;
     }
 
-    raytracer.renderToFile(ofname);
+    raytracer.renderToFile(ofname, pool);
 
     return 0;
 }
@@ -0,0 +1,108 @@
+#include "memoryusage.h"
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+
+using namespace std;
+
+namespace
+{
+    // zero initialized before any constructor runs, so allocations made
+    // during static initialization are counted too
+    atomic<size_t> currentBytes[MemoryUsage::CATEGORIES + 1];  // + total
+    atomic<size_t> peakBytes[MemoryUsage::CATEGORIES + 1];
+
+    thread_local unsigned threadCategory = MemoryUsage::OTHER;
+
+    unsigned const TOTAL = MemoryUsage::CATEGORIES;
+
+    char const *const NAMES[MemoryUsage::CATEGORIES] = {
+        "other", "json", "geometry", "acceleration", "textures",
+        "framebuffer"
+    };
+
+    void add(unsigned idx, size_t bytes)
+    {
+        size_t const now = currentBytes[idx].fetch_add(bytes,
+            memory_order_relaxed) + bytes;
+        size_t peak = peakBytes[idx].load(memory_order_relaxed);
+        while (now > peak && !peakBytes[idx].compare_exchange_weak(peak, now,
+                                 memory_order_relaxed))
+            ;
+    }
+
+    double megabytes(size_t bytes)
+    {
+        return bytes / double(1 << 20);
+    }
+}
+
+MemoryUsage::Scope::Scope(unsigned category)
+:
+    d_previous(threadCategory)
+{
+    threadCategory = category;
+}
+
+MemoryUsage::Scope::~Scope()
+{
+    threadCategory = d_previous;
+}
+
+unsigned MemoryUsage::category()
+{
+    return threadCategory;
+}
+
+size_t MemoryUsage::current(unsigned category)
+{
+    return currentBytes[category].load(memory_order_relaxed);
+}
+
+size_t MemoryUsage::peak(unsigned category)
+{
+    return peakBytes[category].load(memory_order_relaxed);
+}
+
+size_t MemoryUsage::currentTotal()
+{
+    return current(TOTAL);
+}
+
+size_t MemoryUsage::peakTotal()
+{
+    return peak(TOTAL);
+}
+
+char const *MemoryUsage::name(unsigned category)
+{
+    return NAMES[category];
+}
+
+void MemoryUsage::print(ostream &out)
+{
+    ios::fmtflags const flags = out.flags();
+    out << fixed << setprecision(1)
+        << "Memory (MB)      current     peak\n";
+    for (unsigned idx = 0; idx != CATEGORIES; ++idx)
+        out << "  " << left << setw(14) << name(idx) << right
+            << setw(9) << megabytes(current(idx))
+            << setw(9) << megabytes(peak(idx)) << '\n';
+    out << "  " << left << setw(14) << "total" << right
+        << setw(9) << megabytes(currentTotal())
+        << setw(9) << megabytes(peakTotal()) << '\n';
+    out.flags(flags);
+}
+
+void MemoryUsage::allocated(unsigned category, size_t bytes)
+{
+    add(category, bytes);
+    add(TOTAL, bytes);
+}
+
+void MemoryUsage::freed(unsigned category, size_t bytes)
+{
+    currentBytes[category].fetch_sub(bytes, memory_order_relaxed);
+    currentBytes[TOTAL].fetch_sub(bytes, memory_order_relaxed);
+}
@@ -0,0 +1,54 @@
+#ifndef MEMORYUSAGE_H_
+#define MEMORYUSAGE_H_
+
+#include <cstddef>
+#include <iosfwd>
+
+// Heap memory in use per part of the renderer. Every operator new is
+// charged to the category of the calling thread's innermost Scope (OTHER
+// outside any) and its delete to that same category, wherever it
+// happens. Tasks started by a thread inherit its category. Memory mapped
+// files and memory from malloc (as used by lodepng) are not counted.
+class MemoryUsage
+{
+    public:
+        static unsigned const OTHER = 0;
+        static unsigned const JSON = 1;
+        static unsigned const GEOMETRY = 2;         // objects and meshes
+        static unsigned const ACCELERATION = 3;     // trees, grid, batches
+        static unsigned const TEXTURES = 4;
+        static unsigned const FRAMEBUFFER = 5;      // images and their aids
+        static unsigned const CATEGORIES = 6;
+
+        // charges the calling thread's allocations to category while it
+        // exists
+        class Scope
+        {
+            unsigned d_previous;
+
+            public:
+                explicit Scope(unsigned category);
+                ~Scope();
+
+                Scope(Scope const &) = delete;
+                Scope &operator=(Scope const &) = delete;
+        };
+
+        static unsigned category();         // of the calling thread
+
+        static size_t current(unsigned category);
+        static size_t peak(unsigned category);
+        static size_t currentTotal();
+        static size_t peakTotal();          // of the sum, not of the peaks
+
+        static char const *name(unsigned category);
+
+        // a line per category with current and peak megabytes
+        static void print(std::ostream &out);
+
+        // by operator new and delete
+        static void allocated(unsigned category, size_t bytes);
+        static void freed(unsigned category, size_t bytes);
+};
+
+#endif
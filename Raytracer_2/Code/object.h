@@ -4,18 +4,16 @@
 #include "material.h"
 
 // not really needed here, but deriving classes may need them
+#include "bbox.h"
 #include "hit.h"
 #include "ray.h"
 #include "triple.h"
 
-#include <memory>
-class Object;
-typedef std::shared_ptr<Object> ObjectPtr;
-
 class Object
 {
     public:
         Material material;
+        unsigned id = 0;        // index in the scene
 
         virtual ~Object() = default;
 
@@ -24,6 +22,10 @@ class Object
         virtual Color colorAtTexture(Point point, bool rotate) = 0;
         virtual bool isRotated() = 0;
         virtual Vector rotate(Point point) = 0;
+        virtual BBox bounds() const = 0;
+
+        // convex objects do not shadow themselves
+        virtual bool convex() const { return true; }
 };
 
 #endif
@@ -0,0 +1,237 @@
+#include "pagecache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+size_t const PageCache::PAGE_SIZE;
+size_t const PageCache::CACHE_LINE;
+int const PageCache::LOADING;
+unsigned const PageCache::CLAIMED;
+
+namespace
+{
+    // this thread's hit counter
+    unsigned stripe()
+    {
+        static atomic<unsigned> threads(0);
+        thread_local unsigned const own = threads++;
+        return own;
+    }
+}
+
+PageCache::PageCache(size_t budget)
+:
+    d_budget(budget),
+    d_hitMemory(new char[(STRIPES + 1) * CACHE_LINE])
+{
+    // the first line boundary in the memory
+    uintptr_t const start = reinterpret_cast<uintptr_t>(d_hitMemory.get());
+    uintptr_t const aligned = (start + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+    d_hits = reinterpret_cast<Counter *>(aligned);
+    for (unsigned idx = 0; idx != STRIPES; ++idx)
+        new (d_hits + idx) Counter;
+}
+
+PageCache::~PageCache()
+{
+    for (File const &file : d_files)
+        close(file.fd);
+}
+
+void PageCache::setBudget(size_t bytes)
+{
+    lock_guard<mutex> lock(d_mutex);
+    d_budget = bytes;
+}
+
+unsigned PageCache::addFile(string const &filename, size_t offset,
+    unsigned pages)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw runtime_error("Could not open " + filename + '.');
+
+    struct stat info;
+    if (fstat(fd, &info) != 0
+        || size_t(info.st_size) < offset + pages * PAGE_SIZE)
+    {
+        close(fd);
+        throw runtime_error(filename + " is shorter than its pages.");
+    }
+
+    lock_guard<mutex> lock(d_mutex);
+    unsigned const first = d_pages;
+    d_files.push_back(File{ filename, fd, offset, first, pages });
+
+    unique_ptr<atomic<int>[]> frameOf(new atomic<int>[first + pages]);
+    for (unsigned page = 0; page != first + pages; ++page)
+        frameOf[page] = page < first ? d_frameOf[page].load() : -1;
+    d_frameOf.swap(frameOf);
+    d_pages = first + pages;
+
+    // at least one frame, no more than there are pages
+    size_t const frames = min<size_t>(max<size_t>(d_budget / PAGE_SIZE, 1),
+                                      d_pages);
+    while (d_frames.size() < frames) {
+        d_frames.emplace_back(new Frame);
+        d_frames.back()->data.reset(new char[PAGE_SIZE]);
+    }
+    return first;
+}
+
+char const *PageCache::acquire(unsigned page)
+{
+    while (true) {
+        int const frame = d_frameOf[page].load(memory_order_acquire);
+        if (frame >= 0 && pin(*d_frames[frame], page)) {
+            d_hits[stripe() % STRIPES].count.fetch_add(1,
+                memory_order_relaxed);
+            return d_frames[frame]->data.get();
+        }
+
+        // not in memory, or evicted while being pinned
+        if (char const *data = load(page))
+            return data;
+    }
+}
+
+void PageCache::release(unsigned page)
+{
+    // a pinned page keeps its frame
+    unpin(*d_frames[d_frameOf[page].load(memory_order_relaxed)]);
+}
+
+uint64_t PageCache::hits() const
+{
+    uint64_t hits = 0;
+    for (unsigned idx = 0; idx != STRIPES; ++idx)
+        hits += d_hits[idx].count.load(memory_order_relaxed);
+    return hits;
+}
+
+uint64_t PageCache::misses() const
+{
+    lock_guard<mutex> lock(d_mutex);
+    return d_misses;
+}
+
+bool PageCache::pin(Frame &frame, unsigned page)
+{
+    // a frame claimed for eviction, or already holding another page,
+    // cannot be pinned for this one
+    if ((frame.pins.fetch_add(1) & CLAIMED) == 0
+        && frame.page.load(memory_order_acquire) == int(page))
+    {
+        if (!frame.referenced.load(memory_order_relaxed))
+            frame.referenced.store(true, memory_order_relaxed);
+        return true;
+    }
+    unpin(frame);
+    return false;
+}
+
+void PageCache::unpin(Frame &frame)
+{
+    // a thread looking for a frame counts itself in d_waiting before it
+    // looks, so either it sees this frame free or it is woken
+    if (frame.pins.fetch_sub(1) == 1 && d_waiting.load() != 0) {
+        lock_guard<mutex> lock(d_mutex);
+        d_changed.notify_all();
+    }
+}
+
+char const *PageCache::load(unsigned page)
+{
+    unique_lock<mutex> lock(d_mutex);
+    ++d_waiting;
+    int frame;
+    while (true) {
+        int const state = d_frameOf[page].load();
+        if (state >= 0) {
+            --d_waiting;
+            return nullptr;
+        }
+        if (state != LOADING && (frame = claim()) >= 0)
+            break;
+        d_changed.wait(lock);
+    }
+    --d_waiting;
+
+    Frame &victim = *d_frames[frame];
+    int const evicted = victim.page.load();
+    if (evicted >= 0)
+        d_frameOf[evicted].store(-1);
+    victim.page.store(page);
+    d_frameOf[page].store(LOADING);
+    ++d_misses;
+
+    // other pages are found, pinned and loaded meanwhile
+    lock.unlock();
+    try {
+        read(page, victim.data.get());
+    } catch (...) {
+        lock.lock();
+        victim.page.store(-1);
+        d_frameOf[page].store(-1);
+        victim.pins.fetch_sub(CLAIMED);
+        d_changed.notify_all();
+        throw;
+    }
+    lock.lock();
+
+    victim.referenced.store(true, memory_order_relaxed);
+    victim.pins.fetch_add(1 - CLAIMED);     // pinned by this thread only
+    d_frameOf[page].store(frame, memory_order_release);
+    d_changed.notify_all();
+    return victim.data.get();
+}
+
+int PageCache::claim()
+{
+    // the clock hand gives frames used since it last passed a second
+    // chance, so two rounds find any unpinned frame
+    for (size_t step = 0; step != 2 * d_frames.size(); ++step) {
+        unsigned const idx = d_hand;
+        d_hand = (d_hand + 1) % d_frames.size();
+
+        Frame &frame = *d_frames[idx];
+        if (frame.pins.load() != 0)
+            continue;
+        if (frame.page.load() >= 0 && frame.referenced.exchange(false))
+            continue;
+
+        // fails when a reader pinned it just now
+        unsigned unpinned = 0;
+        if (frame.pins.compare_exchange_strong(unpinned, CLAIMED))
+            return idx;
+    }
+    return -1;
+}
+
+void PageCache::read(unsigned page, char *data) const
+{
+    auto file = find_if(d_files.begin(), d_files.end(), [&](File const &f) {
+        return page >= f.first && page < f.first + f.pages;
+    });
+
+    size_t done = 0;
+    off_t const offset = file->offset + size_t(page - file->first) * PAGE_SIZE;
+    while (done != PAGE_SIZE) {
+        ssize_t got = pread(file->fd, data + done, PAGE_SIZE - done,
+                            offset + done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            throw runtime_error("Could not read page "
+                + to_string(page - file->first) + " of " + file->name + '.');
+        done += got;
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef PAGECACHE_H_
+#define PAGECACHE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Fixed size pages of files on disk, read on demand into a limited number
+// of memory frames. Frames are allocated when files are added, so reading
+// pages never allocates. Thread safe: a page already in memory is found
+// and pinned without locking; the lock is only taken to pick a frame to
+// evict (one no thread is reading and that was not used since the clock
+// hand last passed it), and the page is read from disk outside it while
+// other threads wanting the same page wait for it.
+class PageCache
+{
+    public:
+        static size_t const PAGE_SIZE = 64 * 1024;
+
+    private:
+        static int const LOADING = -2;              // page being read
+        static unsigned const CLAIMED = 1u << 31;   // frame being reloaded
+        static unsigned const STRIPES = 16;         // of the hit counter
+        static size_t const CACHE_LINE = 64;
+
+        struct File
+        {
+            std::string name;
+            int fd;
+            size_t offset;          // of the first page in the file
+            unsigned first;         // id of the first page
+            unsigned pages;
+        };
+
+        struct Frame
+        {
+            std::unique_ptr<char[]> data;
+            std::atomic<int> page{ -1 };        // loaded page, -1 when free
+            std::atomic<unsigned> pins{ 0 };    // readers, + CLAIMED
+            std::atomic<bool> referenced{ false };
+        };
+
+        // hits counted apart per group of threads, so readers do not
+        // share a cache line. Padded to a line and placed on line
+        // boundaries by hand: allocations only promise max_align_t.
+        struct Counter
+        {
+            std::atomic<uint64_t> count{ 0 };
+            char padding[CACHE_LINE - sizeof(std::atomic<uint64_t>)];
+        };
+
+        mutable std::mutex d_mutex;
+        std::condition_variable d_changed;  // frame released or page read
+        std::atomic<unsigned> d_waiting{ 0 };
+
+        std::vector<File> d_files;
+        std::vector<std::unique_ptr<Frame>> d_frames;
+        // per page: its frame, -1 when not loaded or LOADING
+        std::unique_ptr<std::atomic<int>[]> d_frameOf;
+        unsigned d_pages = 0;
+        size_t d_budget;                    // bytes
+        unsigned d_hand = 0;                // next frame to consider
+        std::unique_ptr<char[]> d_hitMemory;
+        Counter *d_hits;                    // STRIPES, in d_hitMemory
+        uint64_t d_misses = 0;
+
+    public:
+        explicit PageCache(size_t budget = 256 << 20);
+        ~PageCache();
+
+        PageCache(PageCache const &) = delete;
+        PageCache &operator=(PageCache const &) = delete;
+
+        // memory for frames, takes effect for files added later
+        void setBudget(size_t bytes);
+
+        // pages of the file from offset on, returns the id of the first.
+        // Throws if the file is missing or shorter than its pages. Not
+        // while pages are acquired.
+        unsigned addFile(std::string const &filename, size_t offset,
+                         unsigned pages);
+
+        // the page's data, valid until release(page). Throws if the page
+        // cannot be read in full.
+        char const *acquire(unsigned page);
+        void release(unsigned page);
+
+        uint64_t hits() const;
+        uint64_t misses() const;
+
+    private:
+        bool pin(Frame &frame, unsigned page);
+        void unpin(Frame &frame);
+
+        // read page into a frame pinned for the caller, or nullptr when
+        // another thread got it in memory first
+        char const *load(unsigned page);
+
+        int claim();                        // an unpinned frame, or -1
+        void read(unsigned page, char *data) const;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef PIXELRECORD_H_
+#define PIXELRECORD_H_
+
+#include "bbox.h"
+
+#include <algorithm>
+#include <vector>
+
+// What the rays of one pixel depended on: every object they hit (primary,
+// reflection and blocking shadow rays) and every light they shaded with.
+struct PixelRecord
+{
+    std::vector<unsigned> objects;
+    std::vector<unsigned> lights;
+    BBox hits;                  // primary and reflection hit points
+    bool reflects = false;      // cast reflection rays
+
+    void clear()
+    {
+        objects.clear();
+        lights.clear();
+        hits = BBox();
+        reflects = false;
+    }
+
+    void addObject(unsigned id)
+    {
+        if (std::find(objects.begin(), objects.end(), id) == objects.end())
+            objects.push_back(id);
+    }
+
+    void addLight(unsigned id)
+    {
+        if (std::find(lights.begin(), lights.end(), id) == lights.end())
+            lights.push_back(id);
+    }
+
+    void addHit(unsigned id, Point const &point)
+    {
+        addObject(id);
+        hits.extend(point);
+    }
+};
+
+#endif
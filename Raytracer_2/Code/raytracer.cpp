@@ -1,14 +1,22 @@
 #include "raytracer.h"
 
+#include "camera.h"
+#include "costmap.h"
+#include "filetime.h"
 #include "image.h"
 #include "light.h"
 #include "material.h"
+#include "memoryusage.h"
+#include "rendercache.h"
+#include "threadpool.h"
+#include "timeline.h"
 #include "triple.h"
 
 // =============================================================================
 // -- Include all your shapes here ---------------------------------------------
 // =============================================================================
 
+#include "shapes/mesh.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
 
@@ -18,16 +26,48 @@
 
 #include "json/json.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <exception>
 #include <fstream>
 #include <iostream>
+#include <thread>
 
 using namespace std;        // no std:: required
 using json = nlohmann::json;
 
-bool Raytracer::parseObjectNode(json const &node)
+namespace
 {
-    ObjectPtr obj = nullptr;
+    // area light samples beyond this are not worth their shadow rays
+    double const MAX_LIGHT_SAMPLES = 1024;
+
+    // value as a whole number from min to max, otherwise the scene is
+    // rejected naming what it is
+    unsigned wholeNumber(json const &value, unsigned min, unsigned max,
+                         string const &what)
+    {
+        double const number = value.is_number() ? value.get<double>() : -1;
+        if (!(number >= min && number <= max && number == floor(number)))
+            throw runtime_error(what + " must hold whole numbers from "
+                + to_string(min) + " to " + to_string(max) + '.');
+        return number;
+    }
+
+    unsigned imageSide(json const &value, string const &what)
+    {
+        return wholeNumber(value, 1, Scene::MAX_IMAGE_SIZE, what);
+    }
+}
+
+Raytracer::Raytracer(shared_ptr<TextureCache> textures)
+:
+    textures(textures)
+{}
+
+bool Raytracer::parseObjectNode(json const &node, Tasks::Group &loads)
+{
+    Object *obj = nullptr;
 
 // =============================================================================
 // -- Determine type and parse object parametrers ------------------------------
@@ -49,14 +89,29 @@ bool Raytracer::parseObjectNode(json const &node)
             angle = node["angle"];
         }
 
-		obj = ObjectPtr(new Sphere(pos, radius, rotation, angle));
+		obj = scene.addObject<Sphere>(pos, radius, rotation, angle);
 	}
 	else if (node["type"] == "triangle")
 	{
 		Point vertex0(node["vertex0"]);
 		Point vertex1(node["vertex1"]);
 		Point vertex2(node["vertex2"]);
-		obj = ObjectPtr(new Triangle(vertex0, vertex1, vertex2));
+		obj = scene.addObject<Triangle>(vertex0, vertex1, vertex2);
+	}
+	else if (node["type"] == "mesh")
+	{
+		string const file = node["file"];
+		Point position(node["position"]);
+		double scale = 1;
+		if (node.find("scale") != node.end())
+			scale = node["scale"];
+		// a zero scale divides by zero, a negative one flips the bounds
+		if (!(scale > 0))
+			throw runtime_error("Mesh scale must be positive.");
+		Mesh *mesh = scene.addObject<Mesh>("../Scenes/" + file, position,
+		                                   scale, scene.meshPages());
+		meshes.push_back(mesh);     // loaded by loadMeshes()
+		obj = mesh;
 	}
 	else
 	{
@@ -70,20 +125,61 @@ bool Raytracer::parseObjectNode(json const &node)
     if (!obj)
         return false;
 
-    // Parse material and add object to the scene
-    obj->material = parseMaterialNode(node["material"]);
-    scene.addObject(obj);
+    // Parse material of the object added to the scene
+    parseMaterialNode(node["material"], obj->material, loads);
     return true;
 }
 
+Camera Raytracer::parseCameraNode(json const &node) const
+{
+    Camera camera;
+    camera.hasView = true;
+    camera.eye = Point(node["eye"]);
+    camera.center = Point(node["center"]);
+
+    if (node.find("up") != node.end())
+        camera.up = Vector(node["up"]);
+
+    if (node.find("fov") != node.end())
+        camera.fov = node["fov"];
+
+    if (node.find("viewSize") != node.end()) {
+        camera.width = imageSide(node["viewSize"][0], "viewSize");
+        camera.height = imageSide(node["viewSize"][1], "viewSize");
+    }
+
+    camera.update();
+    return camera;
+}
+
 Light Raytracer::parseLightNode(json const &node) const
 {
     Point pos(node["position"]);
     Color col(node["color"]);
-    return Light(pos, col);
+    if (node.find("type") == node.end())
+        return Light(pos, col);
+
+    // area lights: shadow rays per point in the penumbra, as a square
+    double samples = 16;
+    if (node.find("samples") != node.end()) {
+        samples = node["samples"];
+        if (!(samples >= 1))
+            throw runtime_error("Light samples must be at least 1.");
+        samples = min(samples, MAX_LIGHT_SAMPLES);
+    }
+    unsigned const strata = lround(sqrt(samples));
+
+    string const type = node["type"];
+    if (type == "rectangle")
+        return Light::rectangle(pos, Vector(node["edges"][0]),
+                                Vector(node["edges"][1]), col, strata);
+    if (type == "sphere")
+        return Light::sphere(pos, node["radius"], col, strata);
+    throw runtime_error("Unknown light type " + type + ".");
 }
 
-Material Raytracer::parseMaterialNode(json const &node) const
+void Raytracer::parseMaterialNode(json const &node, Material &material,
+    Tasks::Group &loads)
 {
     double ka = node["ka"];
     double kd = node["kd"];
@@ -92,54 +188,130 @@ Material Raytracer::parseMaterialNode(json const &node) const
 
 	if (node.find("color") != node.end()) {
 		Color color(node["color"]);
-		return Material(color, ka, kd, ks, n);
+		material = Material(color, ka, kd, ks, n);
+		return;
 	}
 	
 	if (node.find("texture") != node.end()) {
-		string const textureFile = node["texture"];
-		return Material("../Scenes/" + textureFile, ka, kd, ks, n);
+		// decoded while the rest of the scene is read
+		string const textureFile = "../Scenes/"
+		                           + node["texture"].get<string>();
+		material = Material(TexturePtr(), ka, kd, ks, n);
+		bool const srgb = scene.hasSRGBOutput();
+		textureLoads.push_back(TextureLoad{ &material, textureFile, srgb });
+		loads.run([this, &material, textureFile, srgb] {
+			material.texture = textures->load(textureFile, srgb);
+		});
+		return;
 	}
 	
-	return Material();
+	material = Material();
 }
 
-bool Raytracer::readScene(string const &ifname)
+bool Raytracer::readScene(string const &ifname, json const *overrides)
 try
 {
-    // Read and parse input json file
+    MemoryUsage::Scope const parsing(MemoryUsage::JSON);
     ifstream infile(ifname);
     if (!infile) throw runtime_error("Could not open input file for reading.");
-    json jsonscene;
-    infile >> jsonscene;
+    scene = Scene();
+    meshes.clear();
+    textureLoads.clear();
 
-// =============================================================================
-// -- Read your scene data in this section -------------------------------------
-// =============================================================================
+    // lights and objects are added to the scene as soon as they are read
+    // and dropped from the document, so only the settings are kept
+    Tasks::Group loads;
+    string section;             // top level key being read
+    unsigned objCount = 0;
+    json::parser_callback_t const streamed = [&](int depth,
+        json::parse_event_t event, json &parsed)
+    {
+        if (depth == 1 && event == json::parse_event_t::key) {
+            section = parsed.get<string>();
+            return true;
+        }
+        // textures read after it are decoded for it right away
+        if (depth == 1 && event == json::parse_event_t::value
+            && section == "SRGBOutput")
+        {
+            scene.setSRGBOutput(parsed);
+            return true;
+        }
+        if (depth != 2 || event != json::parse_event_t::object_end)
+            return true;
 
-    Point eye(jsonscene["Eye"]);
-    scene.setEye(eye);
+        MemoryUsage::Scope const building(MemoryUsage::GEOMETRY);
+        if (section == "Lights") {
+            scene.addLight(parseLightNode(parsed));
+            return false;
+        }
+        if (section == "Objects") {
+            if (parseObjectNode(parsed, loads))
+                ++objCount;
+            return false;
+        }
+        return true;
+    };
+    json settings;
+    {
+        Timeline::Scope const event("parse", ifname);
+        settings = json::parse(infile, streamed);
+    }
 
-    // TODO: add your other configuration settings here
+    if (overrides)
+        for (auto it = overrides->begin(); it != overrides->end(); ++it)
+            settings[it.key()] = it.value();
 
-    if (jsonscene.find("Shadows") != jsonscene.end()) {
-        scene.setShadows(jsonscene["Shadows"]);
-    }
-    
-    if (jsonscene.find("MaxRecursionDepth") != jsonscene.end()) {
-        scene.setRecursionDepth(jsonscene["MaxRecursionDepth"]);
-    }
+    // settings may follow the objects, meshes are loaded once all are known
+    parseSettings(settings);
+    loadMeshes(loads);
+    loads.wait();
+    resolveTextures();
+
+    cout << "Parsed " << objCount << " objects.\n";
+    return true;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
 
-    if (jsonscene.find("SuperSamplingFactor") != jsonscene.end()) {
-        scene.setSamplingFactor(jsonscene["SuperSamplingFactor"]);
+bool Raytracer::readScene(string const &ifname, json &jsonscene)
+try
+{
+    // Read and parse input json file
+    ifstream infile(ifname);
+    if (!infile) throw runtime_error("Could not open input file for reading.");
+    {
+        MemoryUsage::Scope const parsing(MemoryUsage::JSON);
+        Timeline::Scope const event("parse", ifname);
+        infile >> jsonscene;
     }
+    MemoryUsage::Scope const building(MemoryUsage::GEOMETRY);
+    scene = Scene();
+    meshes.clear();
+    textureLoads.clear();
+
+// =============================================================================
+// -- Read your scene data in this section -------------------------------------
+// =============================================================================
+
+    parseSettings(jsonscene);
 
     for (auto const &lightNode : jsonscene["Lights"])
         scene.addLight(parseLightNode(lightNode));
 
+    // textures load on other threads while objects are parsed, meshes
+    // once all objects are
+    Tasks::Group loads;
     unsigned objCount = 0;
     for (auto const &objectNode : jsonscene["Objects"])
-        if (parseObjectNode(objectNode))
+        if (parseObjectNode(objectNode, loads))
             ++objCount;
+    loadMeshes(loads);
+    loads.wait();
+    resolveTextures();
 
     cout << "Parsed " << objCount << " objects.\n";
 
@@ -155,13 +327,215 @@ catch (exception const &ex)
     return false;
 }
 
-void Raytracer::renderToFile(string const &ofname)
+void Raytracer::parseSettings(json const &node)
 {
-    // TODO: the size may be a settings in your file
-    Image img(400, 400);
+    if (node.find("Camera") != node.end()) {
+        scene.setCamera(parseCameraNode(node["Camera"]));
+    } else {
+        Point eye(node.at("Eye"));
+        scene.setEye(eye);
+    }
+
+    if (node.find("ImageSize") != node.end()) {
+        scene.setImageSize(imageSide(node["ImageSize"][0], "ImageSize"),
+                           imageSide(node["ImageSize"][1], "ImageSize"));
+    }
+
+    if (node.find("CropWindow") != node.end()) {
+        json const &crop = node["CropWindow"];
+        unsigned corner[4];
+        for (unsigned idx = 0; idx != 4; ++idx)
+            corner[idx] = wholeNumber(crop[idx], 0, Scene::MAX_IMAGE_SIZE,
+                                      "CropWindow");
+        scene.setCropWindow(CropWindow{ corner[0], corner[1], corner[2],
+                                        corner[3] });
+
+        // clamped to the image
+        CropWindow const window = scene.cropWindow();
+        if (window.x0 >= window.x1 || window.y0 >= window.y1)
+            throw runtime_error("CropWindow must cover part of the image.");
+    }
+
+    if (node.find("Shadows") != node.end()) {
+        scene.setShadows(node["Shadows"]);
+    }
+    
+    if (node.find("SRGBOutput") != node.end()) {
+        scene.setSRGBOutput(node["SRGBOutput"]);
+    }
+
+    if (node.find("Denoise") != node.end()) {
+        scene.setDenoise(node["Denoise"]);
+    }
+
+    if (node.find("CostMap") != node.end()) {
+        string const metric = node["CostMap"];
+        if (metric != "rays" && metric != "time")
+            throw runtime_error("Unknown cost map " + metric + ".");
+        scene.setCostMapMetric(metric == "rays" ? CostMap::RAYS
+                                                : CostMap::TIME);
+    }
+
+    if (node.find("MaxRecursionDepth") != node.end()) {
+        scene.setRecursionDepth(node["MaxRecursionDepth"]);
+    }
+
+    if (node.find("SuperSamplingFactor") != node.end()) {
+        scene.setSamplingFactor(node["SuperSamplingFactor"]);
+    }
+
+    if (node.find("LightSamples") != node.end()) {
+        scene.setLightSamples(node["LightSamples"]);
+    }
+
+    if (node.find("SphereBatching") != node.end()) {
+        scene.setSphereBatching(node["SphereBatching"]);
+    }
+
+    if (node.find("Accelerator") != node.end()) {
+        string const accelerator = node["Accelerator"];
+        if (accelerator != "list" && accelerator != "grid")
+            throw runtime_error("Unknown accelerator " + accelerator + ".");
+
+        double density = 2;
+        if (node.find("GridDensity") != node.end())
+            density = node["GridDensity"];
+        scene.setGrid(accelerator == "grid", density);
+    }
+
+    if (node.find("MeshMemory") != node.end()) {
+        double const megabytes = node["MeshMemory"];
+        scene.setMeshMemory(megabytes * (1 << 20));
+    }
+
+    if (node.find("MeshCache") != node.end()) {
+        scene.setMeshCache(node["MeshCache"]);
+    }
+
+    if (node.find("MeshBuild") != node.end()) {
+        string const build = node["MeshBuild"];
+        if (build != "fast" && build != "full")
+            throw runtime_error("Unknown mesh build " + build + ".");
+        scene.setFastMeshBuild(build == "fast");
+    }
+
+    if (node.find("LazyMeshes") != node.end()) {
+        scene.setLazyMeshBuild(node["LazyMeshes"]);
+    }
+
+    if (node.find("MeshBuildMemory") != node.end()) {
+        double const megabytes = node["MeshBuildMemory"];
+        if (!(megabytes > 0))
+            throw runtime_error("MeshBuildMemory must be positive.");
+        scene.setMeshBuildMemory(megabytes * (1 << 20));
+    }
+}
+
+void Raytracer::loadMeshes(Tasks::Group &loads)
+{
+    MemoryUsage::Scope const scope(MemoryUsage::GEOMETRY);
+    Mesh::Settings settings;
+    settings.cacheDir = scene.meshCacheDir();
+    settings.fast = scene.fastMeshBuilds();
+    settings.lazy = scene.lazyMeshBuilds();
+    settings.buildMemory = scene.meshBuildMemory();
+
+    for (Mesh *mesh : meshes)
+        loads.run([mesh, settings] { mesh->load(settings); });
+    meshes.clear();
+}
+
+void Raytracer::resolveTextures()
+{
+    // only when the scene asks for sRGB output after its textures
+    MemoryUsage::Scope const scope(MemoryUsage::TEXTURES);
+    for (TextureLoad const &load : textureLoads)
+        if (load.srgb != scene.hasSRGBOutput())
+            load.material->texture = textures->load(load.file,
+                                                    scene.hasSRGBOutput());
+    textureLoads.clear();
+}
+
+Scene const &Raytracer::getScene() const
+{
+    return scene;
+}
+
+RenderStats Raytracer::renderToFile(string const &ofname, ThreadPool &pool)
+{
+    MemoryUsage::Scope const scope(MemoryUsage::FRAMEBUFFER);
+    Image img(scene.width(), scene.height());
+    img.setSRGB(scene.hasSRGBOutput());
+
+    if (scene.hasCropWindow()) {
+        // only the crop window is traced, the rest comes from the previous
+        // render when there is one of the same size
+        if (ifstream(ofname)) {
+            Image previous(ofname, scene.hasSRGBOutput());
+            if (previous.width() == img.width()
+                && previous.height() == img.height())
+            {
+                img = previous;
+                cout << "Compositing into " << ofname << ".\n";
+            }
+        }
+    }
+
+    CostMap costs(scene.costMapMetric());
+    if (costs.metric() != CostMap::NONE)
+        costs.resize(img.width(), img.height());
+
     cout << "Tracing...\n";
-    scene.render(img);
+    RenderStats stats = scene.render(img, pool,
+        costs.metric() != CostMap::NONE ? &costs : nullptr);
+    stats.print(cout);
     cout << "Writing image to " << ofname << "...\n";
     img.write_png(ofname);
+
+    if (costs.metric() != CostMap::NONE) {
+        // next to the image: out.png -> out-cost.png
+        string costName = ofname;
+        costName.insert(min(costName.find_last_of('.'), costName.size()),
+                        "-cost");
+        float const scale = costs.scale(scene.cropWindow());
+        cout << "Writing cost map to " << costName << " (white: " << scale
+             << ' ' << costs.unit() << " per pixel)...\n";
+        costs.image(scale).write_png(costName);
+    }
+    MemoryUsage::print(cout);
     cout << "Done.\n";
+    return stats;
+}
+
+string Raytracer::outputName(string const &ifname)
+{
+    string ofname = ifname;
+    ofname.erase(ofname.begin() + ofname.find_last_of('.'), ofname.end());
+    return ofname + ".png";
+}
+
+void Raytracer::watch(string const &ifname, string const &ofname,
+    ThreadPool &pool)
+{
+    RenderCache cache;
+
+    while (true)
+    {
+        long long const stamp = modificationTime(ifname);
+
+        json jsonscene;
+        if (readScene(ifname, jsonscene))
+        {
+            cout << "Tracing...\n";
+            unsigned traced = cache.render(scene, jsonscene, pool);
+            cout << "Traced " << traced << " of "
+                 << cache.image().size() << " pixels.\n";
+            cout << "Writing image to " << ofname << "...\n";
+            cache.image().write_png(ofname);
+        }
+
+        cout << "Watching " << ifname << " for changes.\n" << flush;
+        while (modificationTime(ifname) == stamp)
+            this_thread::sleep_for(chrono::milliseconds(200));
+    }
 }
@@ -2,30 +2,76 @@
 #define RAYTRACER_H_
 
 #include "scene.h"
+#include "tasks.h"
+#include "texturecache.h"
 
+#include <memory>
 #include <string>
+#include <vector>
 
 // Forward declerations
+class Camera;
 class Light;
 class Material;
+class Mesh;
+class ThreadPool;
 
 #include "json/json_fwd.h"
 
 class Raytracer
 {
     Scene scene;
+    std::shared_ptr<TextureCache> textures;     // kept between scenes
+    std::vector<Mesh *> meshes;                 // parsed, not loaded yet
+
+    // textures of the scene being read, decoded for the output known when
+    // their material was parsed
+    struct TextureLoad
+    {
+        Material *material;
+        std::string file;
+        bool srgb;
+    };
+    std::vector<TextureLoad> textureLoads;
 
     public:
 
-        bool readScene(std::string const &ifname);
-        void renderToFile(std::string const &ofname);
+        explicit Raytracer(std::shared_ptr<TextureCache> textures =
+                               std::make_shared<TextureCache>());
+
+        // streams the file: lights and objects are added as they are read,
+        // without keeping the whole document in memory. Settings in
+        // overrides replace the file's, for variants of a scene.
+        bool readScene(std::string const &ifname,
+                       nlohmann::json const *overrides = nullptr);
+        Scene const &getScene() const;
+        RenderStats renderToFile(std::string const &ofname, ThreadPool &pool);
+
+        // render, then re-render whenever ifname changes, tracing only the
+        // pixels affected by the edit
+        void watch(std::string const &ifname, std::string const &ofname,
+                   ThreadPool &pool);
+
+        // in-file with .json replaced by .png
+        static std::string outputName(std::string const &ifname);
 
     private:
 
-        bool parseObjectNode(nlohmann::json const &node);
+        // keeps the whole document in jsonscene
+        bool readScene(std::string const &ifname, nlohmann::json &jsonscene);
+        // everything but the lights and objects
+        void parseSettings(nlohmann::json const &node);
+        void loadMeshes(Tasks::Group &loads);
+        // decode again the textures decoded for other output than the
+        // scene's, once all loads are done
+        void resolveTextures();
+        bool parseObjectNode(nlohmann::json const &node,
+                             Tasks::Group &loads);
 
+        Camera parseCameraNode(nlohmann::json const &node) const;
         Light parseLightNode(nlohmann::json const &node) const;
-        Material parseMaterialNode(nlohmann::json const &node) const;
+        void parseMaterialNode(nlohmann::json const &node,
+                               Material &material, Tasks::Group &loads);
 };
 
 #endif
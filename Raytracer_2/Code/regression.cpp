@@ -0,0 +1,253 @@
+#include "regression.h"
+
+#include "image.h"
+#include "raytracer.h"
+#include "threadpool.h"
+
+#include "json/json.h"
+
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    // RGBA bytes as written by Image::write_png
+    vector<unsigned char> bytes(Image const &image)
+    {
+        vector<unsigned char> rgba(image.size() * 4);
+        image.resolve(rgba.data());
+        return rgba;
+    }
+
+    vector<double> luminance(Image const &image)
+    {
+        vector<unsigned char> const rgba = bytes(image);
+        vector<double> luma;
+        luma.reserve(image.size());
+        for (unsigned idx = 0; idx != image.size(); ++idx)
+        {
+            unsigned char const *pixel = &rgba[4 * idx];
+            luma.push_back(0.299 * pixel[0] + 0.587 * pixel[1]
+                           + 0.114 * pixel[2]);
+        }
+        return luma;
+    }
+
+    double setting(json const &scene, json const &manifest, char const *key,
+                   double fallback)
+    {
+        if (scene.find(key) != scene.end())
+            return scene[key];
+        if (manifest.find(key) != manifest.end())
+            return manifest[key];
+        return fallback;
+    }
+}
+
+Regression::Regression(string const &manifest, ThreadPool &pool)
+:
+    d_manifest(manifest),
+    d_pool(pool)
+{}
+
+bool Regression::run(bool record)
+try
+{
+    ifstream in(d_manifest);
+    if (!in)
+        throw runtime_error("Could not open " + d_manifest + '.');
+    json manifest;
+    in >> manifest;
+
+    size_t const slash = d_manifest.find_last_of('/');
+    string const dir = slash == string::npos ? ""
+                                             : d_manifest.substr(0, slash + 1);
+
+    string const timingsFile = dir + "timings.json";
+    json timings = json::object();
+    ifstream timingsIn(timingsFile);
+    if (timingsIn)
+        timingsIn >> timings;
+
+    double const tolerance = setting(json::object(), manifest,
+                                     "TimeTolerance", 0.25);
+    unsigned const repeats = setting(json::object(), manifest, "Repeats", 3);
+
+    cout << fixed << setprecision(3)
+         << setw(8) << "PSNR" << setw(8) << "SSIM" << setw(10) << "trace s"
+         << setw(10) << "base s" << setw(12) << "Mrays/s" << "  scene\n";
+
+    bool passed = true;
+    json measured = json::object();
+    for (json const &entry : manifest["Scenes"])
+    {
+        string const sceneFile = entry["scene"];
+        // variants of a scene file need names of their own
+        string const name = entry.find("name") != entry.end()
+            ? entry["name"].get<string>() : sceneFile;
+        json const *overrides = entry.find("settings") != entry.end()
+            ? &entry["settings"] : nullptr;
+
+        Raytracer raytracer;
+        bool const read = raytracer.readScene(dir + sceneFile, overrides);
+        if (entry.value("fails", false))
+        {
+            // a broken scene must be rejected, not rendered or crash
+            cout << setw(36) << (read ? "read" : "rejected") << "  "
+                 << name << '\n';
+            if (read)
+                cout << "FAIL  " << name << ": read, should fail\n";
+            passed = passed && !read;
+            continue;
+        }
+        if (!read)
+        {
+            cout << "FAIL  " << name << ": cannot read scene\n";
+            passed = false;
+            continue;
+        }
+
+        string const referenceFile = entry["reference"];
+
+        // the fastest of a few renders is least disturbed by other load
+        Scene scene(raytracer.getScene());
+        Image image(scene.width(), scene.height());
+        image.setSRGB(scene.hasSRGBOutput());
+        RenderStats stats = scene.render(image, d_pool);
+        for (unsigned run = 1; run < repeats; ++run)
+        {
+            RenderStats again = scene.render(image, d_pool);
+            if (again.traceSeconds < stats.traceSeconds)
+                stats = again;
+        }
+
+        Image reference(dir + referenceFile);
+        double const quality = psnr(image, reference);
+        double const structure = ssim(image, reference);
+        double const rays = stats.primaryRays + stats.reflectionRays
+            + stats.shadowRays;
+        measured[name] = stats.traceSeconds;
+
+        double baseline = numeric_limits<double>::quiet_NaN();
+        if (timings.find(name) != timings.end())
+            baseline = timings[name];
+
+        vector<string> problems;
+        if (quality < setting(entry, manifest, "MinPSNR", 40))
+            problems.push_back("PSNR too low");
+        if (structure < setting(entry, manifest, "MinSSIM", 0.99))
+            problems.push_back("SSIM too low");
+        if (!record && stats.traceSeconds > baseline * (1 + tolerance))
+            problems.push_back("slower than baseline");
+
+        cout << setw(8) << quality << setw(8) << structure
+             << setw(10) << stats.traceSeconds;
+        if (isnan(baseline))
+            cout << setw(10) << '-';
+        else
+            cout << setw(10) << baseline;
+        cout << setw(12) << rays / stats.traceSeconds / 1e6
+             << "  " << name << '\n';
+        for (string const &problem : problems)
+            cout << "FAIL  " << name << ": " << problem << '\n';
+
+        passed = passed && problems.empty();
+    }
+    cout.unsetf(ios::floatfield);
+
+    if (record)
+    {
+        ofstream(timingsFile) << measured.dump(4) << '\n';
+        cout << "Recorded timings in " << timingsFile << ".\n";
+    }
+
+    cout << (passed ? "All scenes passed.\n" : "Regressions found.\n");
+    return passed;
+}
+catch (exception const &ex)
+{
+    cerr << ex.what() << '\n';
+    return false;
+}
+
+double Regression::psnr(Image const &image, Image const &reference)
+{
+    if (image.width() != reference.width()
+        || image.height() != reference.height())
+        return 0;
+
+    vector<unsigned char> const a = bytes(image);
+    vector<unsigned char> const b = bytes(reference);
+    double error = 0;
+    for (unsigned idx = 0; idx != image.size(); ++idx)
+    {
+        for (int channel = 0; channel != 3; ++channel)
+        {
+            double diff = a[4 * idx + channel] - b[4 * idx + channel];
+            error += diff * diff;
+        }
+    }
+
+    double const mse = error / (3.0 * image.size());
+    if (mse == 0)
+        return numeric_limits<double>::infinity();
+    return 10 * log10(255.0 * 255.0 / mse);
+}
+
+double Regression::ssim(Image const &image, Image const &reference)
+{
+    unsigned const width = image.width();
+    unsigned const height = image.height();
+    if (width != reference.width() || height != reference.height())
+        return 0;
+
+    // mean SSIM of the luminance over all 8x8 windows
+    unsigned const window = 8;
+    double const c1 = (0.01 * 255) * (0.01 * 255);
+    double const c2 = (0.03 * 255) * (0.03 * 255);
+
+    vector<double> const a = luminance(image);
+    vector<double> const b = luminance(reference);
+
+    double total = 0;
+    unsigned count = 0;
+    for (unsigned y0 = 0; y0 + window <= height; ++y0)
+    {
+        for (unsigned x0 = 0; x0 + window <= width; ++x0)
+        {
+            double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+            for (unsigned y = y0; y != y0 + window; ++y)
+            {
+                for (unsigned x = x0; x != x0 + window; ++x)
+                {
+                    double const va = a[y * width + x];
+                    double const vb = b[y * width + x];
+                    sa += va;
+                    sb += vb;
+                    saa += va * va;
+                    sbb += vb * vb;
+                    sab += va * vb;
+                }
+            }
+
+            double const n = window * window;
+            double const ma = sa / n;
+            double const mb = sb / n;
+            double const va = saa / n - ma * ma;
+            double const vb = sbb / n - mb * mb;
+            double const cov = sab / n - ma * mb;
+
+            total += (2 * ma * mb + c1) * (2 * cov + c2)
+                / ((ma * ma + mb * mb + c1) * (va + vb + c2));
+            ++count;
+        }
+    }
+    return count == 0 ? 0 : total / count;
+}
@@ -0,0 +1,46 @@
+#ifndef REGRESSION_H_
+#define REGRESSION_H_
+
+#include <string>
+
+class Image;
+class ThreadPool;
+
+// Golden image regression check. The manifest (json) lists scenes with a
+// reference image each, and the quality thresholds:
+//     {
+//         "MinPSNR": 40, "MinSSIM": 0.99, "TimeTolerance": 0.25, "Repeats": 3,
+//         "Scenes": [
+//             {"scene": "../Scenes/scene01.json",
+//              "reference": "scene01.png", "MinPSNR": 30},
+//             {"scene": "../Scenes/scene01.json", "name": "scene01-ss",
+//              "settings": {"SuperSamplingFactor": 2},
+//              "reference": "scene01-ss.png"},
+//             {"scene": "broken.json", "fails": true}
+//         ]
+//     }
+// Paths are relative to the manifest, per scene thresholds override the
+// global ones. "settings" replace the scene file's, a variant so made
+// needs a "name" (used in the output and the timings) of its own. The
+// fastest of Repeats renders counts as the trace time; it is compared
+// against timings.json next to the manifest (machine specific, written by
+// record). A scene marked "fails" passes when it cannot be read, to check
+// broken scenes are rejected; it needs no reference.
+class Regression
+{
+    std::string d_manifest;
+    ThreadPool &d_pool;
+
+    public:
+        Regression(std::string const &manifest, ThreadPool &pool);
+
+        // render every scene and compare; false if any scene got worse.
+        // record stores the measured times as the new timing baseline.
+        bool run(bool record);
+
+        // image quality metrics on the 8-bit values that write_png stores
+        static double psnr(Image const &image, Image const &reference);
+        static double ssim(Image const &image, Image const &reference);
+};
+
+#endif
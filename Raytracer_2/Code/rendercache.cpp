@@ -0,0 +1,221 @@
+#include "rendercache.h"
+
+#include "memoryusage.h"
+#include "scene.h"
+#include "timeline.h"
+
+#include "json/json.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    // old index -> new index (-1 if gone) for items matched by their text,
+    // added receives the new indices without an old counterpart
+    vector<int> match(vector<string> const &before,
+                      vector<string> const &after,
+                      vector<unsigned> &added)
+    {
+        multimap<string, unsigned> unused;
+        for (unsigned idx = 0; idx != before.size(); ++idx)
+            unused.emplace(before[idx], idx);
+
+        vector<int> mapping(before.size(), -1);
+        for (unsigned idx = 0; idx != after.size(); ++idx)
+        {
+            auto found = unused.find(after[idx]);
+            if (found == unused.end())
+            {
+                added.push_back(idx);
+                continue;
+            }
+            mapping[found->second] = idx;
+            unused.erase(found);
+        }
+        return mapping;
+    }
+
+    double angle(Vector const &a, Vector const &b)
+    {
+        double cosine = a.dot(b) / (a.length() * b.length());
+        return acos(fmax(-1.0, fmin(1.0, cosine)));
+    }
+
+    // can a primary ray through pixel (x, y) hit the sphere?
+    bool pixelSees(Camera const &camera, unsigned x, unsigned y,
+                   Point const &center, double radius)
+    {
+        Ray mid(camera.ray(x + 0.5, y + 0.5));
+        Vector toCenter = center - mid.O;
+        double dist = toCenter.length();
+        if (dist <= radius)
+            return true;
+
+        // half the opening angle of the pixel's cone of rays
+        double spread = 0.0;
+        for (unsigned corner = 0; corner != 4; ++corner)
+            spread = fmax(spread, angle(mid.D,
+                camera.ray(x + (corner & 1), y + (corner >> 1)).D));
+
+        return angle(mid.D, toCenter) <= asin(radius / dist) + spread;
+    }
+
+    double segmentDistance(Point const &from, Point const &to,
+                           Point const &point)
+    {
+        Vector seg = to - from;
+        double len2 = seg.length_2();
+        double t = len2 > 0 ? (point - from).dot(seg) / len2 : 0.0;
+        t = fmax(0.0, fmin(1.0, t));
+        return (from + t * seg - point).length();
+    }
+}
+
+unsigned RenderCache::render(Scene &scene, json const &node,
+    ThreadPool &pool)
+{
+    json settings = node;
+    settings.erase("Objects");
+    settings.erase("Lights");
+
+    vector<string> objects;
+    for (auto const &objectNode : node["Objects"])
+        objects.push_back(objectNode.dump());
+
+    vector<string> lights;
+    for (auto const &lightNode : node["Lights"])
+        lights.push_back(lightNode.dump());
+
+    string const settingsText = settings.dump();
+    CropWindow const window = scene.cropWindow();
+
+    // sampled lights are picked from a table over all lights, any change
+    // to them changes the weights of every lit pixel
+    bool const lightsKept = scene.lightSampleCount() == 0
+        || lights == d_lights;
+
+    vector<unsigned> pixels;
+    if (d_valid && settingsText == d_settings && lightsKept
+        && objects.size() == scene.getNumObject())
+    {
+        pixels = dirtyPixels(scene, objects, lights);
+    }
+    else
+    {
+        // first render, or something changed that affects every pixel
+        MemoryUsage::Scope const scope(MemoryUsage::FRAMEBUFFER);
+        d_image = Image(scene.width(), scene.height());
+        d_records.assign(d_image.size(), PixelRecord());
+        if (scene.denoises())
+            d_denoiser.resize(d_image.width(), d_image.height());
+        for (unsigned y = window.y0; y < window.y1; ++y)
+            for (unsigned x = window.x0; x < window.x1; ++x)
+                pixels.push_back(y * d_image.width() + x);
+    }
+
+    d_image.setSRGB(scene.hasSRGBOutput());
+    d_denoise = scene.denoises();
+    scene.renderPixels(d_image, pixels, d_records, pool,
+                       d_denoise ? &d_denoiser : nullptr);
+
+    if (d_denoise) {
+        MemoryUsage::Scope const scope(MemoryUsage::FRAMEBUFFER);
+        Timeline::Scope const event("denoise");
+        d_filtered = d_image;
+        d_denoiser.filter(d_filtered, window, pool);
+    }
+
+    d_valid = true;
+    d_settings = settingsText;
+    d_objects = objects;
+    d_lights = lights;
+    return pixels.size();
+}
+
+Image const &RenderCache::image() const
+{
+    return d_denoise ? d_filtered : d_image;
+}
+
+vector<unsigned> RenderCache::dirtyPixels(Scene const &scene,
+    vector<string> const &objects, vector<string> const &lights)
+{
+    vector<unsigned> addedObjects;
+    vector<int> objectMap = match(d_objects, objects, addedObjects);
+
+    vector<unsigned> addedLights;
+    vector<int> lightMap = match(d_lights, lights, addedLights);
+
+    // new geometry may now be seen, block shadow rays or be reflected
+    vector<BBox> added;
+    for (unsigned idx : addedObjects)
+        added.push_back(scene.getObject(idx)->bounds());
+
+    Camera const &camera = scene.getCamera();
+    CropWindow const window = scene.cropWindow();
+    unsigned const width = d_image.width();
+
+    vector<unsigned> pixels;
+    for (unsigned y = window.y0; y < window.y1; ++y)
+    {
+        for (unsigned x = window.x0; x < window.x1; ++x)
+        {
+            unsigned const pixel = y * width + x;
+            PixelRecord &record = d_records[pixel];
+
+            bool dirty = !addedLights.empty() && !record.objects.empty();
+
+            for (unsigned id : record.objects)
+                dirty = dirty || objectMap[id] < 0;
+            for (unsigned id : record.lights)
+                dirty = dirty || lightMap[id] < 0;
+
+            for (BBox const &box : added)
+            {
+                if (dirty)
+                    break;
+
+                Point const center = box.center();
+                double const radius = box.radius();
+
+                // reflection rays could go anywhere
+                dirty = record.reflects
+                    || pixelSees(camera, x, y, center, radius);
+
+                if (dirty || !scene.hasShadows() || record.hits.empty())
+                    continue;
+
+                // the shadow rays of this pixel lie between the light and
+                // the hit points, which is inside the capsule from the
+                // light's centre to the ball around the hit points, grown
+                // by the size of an area light
+                for (unsigned idx = 0; idx != scene.getNumLights(); ++idx)
+                {
+                    Light const &light = scene.getLight(idx);
+                    double dist = segmentDistance(light.position,
+                        record.hits.center(), center);
+                    dirty = dirty || dist <= radius + record.hits.radius()
+                        + light.extent();
+                }
+            }
+
+            if (dirty)
+            {
+                pixels.push_back(pixel);
+                continue;
+            }
+
+            // still valid, refer to the new indices
+            for (unsigned &id : record.objects)
+                id = objectMap[id];
+            for (unsigned &id : record.lights)
+                id = lightMap[id];
+        }
+    }
+    return pixels;
+}
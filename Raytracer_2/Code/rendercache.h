@@ -0,0 +1,52 @@
+#ifndef RENDERCACHE_H_
+#define RENDERCACHE_H_
+
+#include "denoiser.h"
+#include "image.h"
+#include "pixelrecord.h"
+
+#include "json/json_fwd.h"
+
+#include <string>
+#include <vector>
+
+class Scene;
+class ThreadPool;
+
+// Keeps the last rendered image together with what every pixel depended
+// on. After the scene file is edited, only the pixels that may have
+// changed are traced again.
+class RenderCache
+{
+    bool d_valid = false;
+    std::string d_settings;                 // everything but objects/lights
+    std::vector<std::string> d_objects;     // per object, its json text
+    std::vector<std::string> d_lights;      // per light, its json text
+
+    Image d_image;                          // as traced
+    std::vector<PixelRecord> d_records;
+
+    // with Denoise, the guides of every pixel are kept too and the whole
+    // traced image is filtered again after each render
+    bool d_denoise = false;
+    Denoiser d_denoiser;
+    Image d_filtered;
+
+    public:
+        // Render scene (parsed from node) into image(), denoised if the
+        // scene asks for it. Returns the number of pixels that had to be
+        // traced.
+        unsigned render(Scene &scene, nlohmann::json const &node,
+                        ThreadPool &pool);
+
+        Image const &image() const;
+
+    private:
+        // pixels whose records depend on a change between the cached scene
+        // and this one; remaps the ids in the other records
+        std::vector<unsigned> dirtyPixels(Scene const &scene,
+            std::vector<std::string> const &objects,
+            std::vector<std::string> const &lights);
+};
+
+#endif
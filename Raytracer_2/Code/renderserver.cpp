@@ -0,0 +1,297 @@
+#include "renderserver.h"
+
+#include "filetime.h"
+#include "image.h"
+
+#include "json/json.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <exception>
+#include <iostream>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    // largest overrides a job may ask for, so one job cannot make the
+    // daemon allocate or trace without bound
+    unsigned const MAX_SAMPLES = 16;        // sampling factor
+
+    // a whole number from 1 to max; clients send sizes as 640.0 too
+    bool inRange(json const &value, unsigned max)
+    {
+        if (!value.is_number())
+            return false;
+        double const number = value;
+        return number >= 1 && number <= max && number == floor(number);
+    }
+
+    bool socketAddress(string const &path, sockaddr_un &address)
+    {
+        if (path.size() >= sizeof(address.sun_path))
+            return false;
+
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        return true;
+    }
+
+    bool readLine(int fd, string &line)
+    {
+        line.clear();
+        char ch;
+        while (read(fd, &ch, 1) == 1)
+        {
+            if (ch == '\n')
+                return true;
+            line += ch;
+        }
+        return false;
+    }
+
+    bool readAll(int fd, unsigned char *data, size_t size)
+    {
+        while (size != 0)
+        {
+            ssize_t count = read(fd, data, size);
+            if (count <= 0)
+                return false;
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool writeAll(int fd, void const *buffer, size_t size)
+    {
+        char const *data = static_cast<char const *>(buffer);
+        while (size != 0)
+        {
+            // no SIGPIPE when the other side went away
+            ssize_t count = send(fd, data, size, MSG_NOSIGNAL);
+            if (count <= 0)
+                return false;
+            data += count;
+            size -= count;
+        }
+        return true;
+    }
+
+    bool writeLine(int fd, json const &node)
+    {
+        string const line = node.dump() + '\n';
+        return writeAll(fd, line.data(), line.size());
+    }
+}
+
+RenderServer::RenderServer(string const &socketPath, ThreadPool &pool)
+:
+    d_socket(socketPath),
+    d_pool(pool)
+{}
+
+bool RenderServer::run()
+{
+    sockaddr_un address;
+    if (!socketAddress(d_socket, address))
+    {
+        cerr << "Socket path too long: " << d_socket << '\n';
+        return false;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(d_socket.c_str());       // left over from an earlier daemon
+    if (listener < 0
+        || bind(listener, reinterpret_cast<sockaddr *>(&address),
+                sizeof(address)) != 0
+        || listen(listener, 16) != 0)
+    {
+        cerr << "Cannot listen on " << d_socket << ": " << strerror(errno)
+             << '\n';
+        return false;
+    }
+
+    cout << "Listening on " << d_socket << ".\n" << flush;
+    while (true)
+    {
+        int connection = accept(listener, nullptr, nullptr);
+        if (connection < 0)
+            continue;
+        serve(connection);
+        close(connection);
+    }
+}
+
+void RenderServer::serve(int connection)
+{
+    string line;
+    if (!readLine(connection, line))
+        return;
+
+    auto const start = chrono::steady_clock::now();
+
+    vector<unsigned char> png;
+    string error;
+    bool rendered = false;
+    try
+    {
+        rendered = render(json::parse(line), png, error);
+    }
+    catch (exception const &ex)
+    {
+        error = ex.what();
+    }
+
+    if (!rendered)
+    {
+        cout << "Job failed: " << error << '\n' << flush;
+        writeLine(connection, json{ { "status", "error" },
+                                    { "message", error } });
+        return;
+    }
+
+    auto const milliseconds = chrono::duration_cast<chrono::milliseconds>(
+        chrono::steady_clock::now() - start).count();
+    cout << "Rendered job in " << milliseconds << " ms.\n" << flush;
+
+    writeLine(connection, json{ { "status", "ok" },
+                                { "bytes", png.size() },
+                                { "milliseconds", milliseconds } });
+    writeAll(connection, png.data(), png.size());
+}
+
+bool RenderServer::render(json const &job, vector<unsigned char> &png,
+    string &error)
+{
+    if (job.find("scene") == job.end())
+    {
+        error = "job has no scene";
+        return false;
+    }
+
+    string const filename = job["scene"];
+    Scene const *cached = scene(filename);
+    if (!cached)
+    {
+        error = "cannot read scene " + filename;
+        return false;
+    }
+
+    // the copy shares objects and textures with the cached scene
+    Scene scene(*cached);
+
+    if (job.find("eye") != job.end())
+        scene.setEye(Point(job["eye"]));
+
+    if (job.find("size") != job.end())
+    {
+        json const &size = job["size"];
+        if (!size.is_array() || size.size() != 2
+            || !inRange(size[0], Scene::MAX_IMAGE_SIZE)
+            || !inRange(size[1], Scene::MAX_IMAGE_SIZE))
+        {
+            error = "size must be two whole numbers from 1 to "
+                + to_string(Scene::MAX_IMAGE_SIZE);
+            return false;
+        }
+        scene.setImageSize(size[0].get<double>(), size[1].get<double>());
+    }
+
+    if (job.find("samples") != job.end())
+    {
+        if (!inRange(job["samples"], MAX_SAMPLES))
+        {
+            error = "samples must be a whole number from 1 to "
+                + to_string(MAX_SAMPLES);
+            return false;
+        }
+        scene.setSamplingFactor(job["samples"].get<double>());
+    }
+
+    Image img(scene.width(), scene.height());
+    img.setSRGB(scene.hasSRGBOutput());
+    scene.render(img, d_pool);
+    img.encode_png(png);
+    return true;
+}
+
+Scene const *RenderServer::scene(string const &filename)
+{
+    long long const modified = modificationTime(filename);
+
+    auto found = d_scenes.find(filename);
+    if (found != d_scenes.end() && found->second.modified == modified)
+        return &found->second.scene;
+
+    if (!d_raytracer.readScene(filename))
+        return nullptr;
+
+    Entry &entry = d_scenes[filename];
+    entry.modified = modified;
+    entry.scene = d_raytracer.getScene();
+    entry.scene.prepare();
+    return &entry.scene;
+}
+
+bool requestRender(string const &socketPath, json const &job,
+                   vector<unsigned char> &png, string &error)
+{
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address))
+    {
+        error = "socket path too long";
+        return false;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (connection < 0
+        || connect(connection, reinterpret_cast<sockaddr *>(&address),
+                   sizeof(address)) != 0)
+    {
+        error = string("cannot connect to ") + socketPath + ": "
+            + strerror(errno);
+        if (connection >= 0)
+            close(connection);
+        return false;
+    }
+
+    string line;
+    bool ok = writeLine(connection, job) && readLine(connection, line);
+    if (!ok)
+        error = "connection lost";
+
+    if (ok)
+    try
+    {
+        json reply = json::parse(line);
+        if (reply["status"] != "ok")
+        {
+            error = reply["message"];
+            ok = false;
+        }
+        else
+        {
+            png.resize(reply["bytes"].get<size_t>());
+            ok = readAll(connection, png.data(), png.size());
+            if (!ok)
+                error = "connection lost";
+        }
+    }
+    catch (exception const &ex)
+    {
+        error = ex.what();
+        ok = false;
+    }
+
+    close(connection);
+    return ok;
+}
@@ -0,0 +1,58 @@
+#ifndef RENDERSERVER_H_
+#define RENDERSERVER_H_
+
+#include "raytracer.h"
+#include "scene.h"
+#include "threadpool.h"
+
+#include "json/json_fwd.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Render daemon: keeps parsed (and prepared) scenes and decoded textures in
+// memory and renders jobs sent over a Unix socket, one at a time.
+//
+// A job is one line of json:
+//     {"scene": "/abs/scene.json", "eye": [x, y, z], "size": [w, h],
+//      "samples": n}
+// where everything but "scene" is an optional override. Sizes up to 16384
+// pixels a side and up to 16 samples (per pixel side) are accepted. The
+// reply is one
+// line of json, {"status": "ok", "bytes": n, "milliseconds": t} followed by
+// n bytes of PNG, or {"status": "error", "message": "..."}.
+class RenderServer
+{
+    struct Entry
+    {
+        long long modified;
+        Scene scene;
+    };
+
+    std::string d_socket;
+    ThreadPool &d_pool;
+    Raytracer d_raytracer;                  // parses, caches textures
+    std::map<std::string, Entry> d_scenes;
+
+    public:
+        RenderServer(std::string const &socketPath, ThreadPool &pool);
+
+        // serve until killed, false if the socket cannot be set up
+        bool run();
+
+    private:
+        void serve(int connection);
+        bool render(nlohmann::json const &job, std::vector<unsigned char> &png,
+                    std::string &error);
+
+        // cached scene, (re)loaded when its file changed
+        Scene const *scene(std::string const &filename);
+};
+
+// Client side: send job to the daemon listening on socketPath and receive
+// the rendered PNG
+bool requestRender(std::string const &socketPath, nlohmann::json const &job,
+                   std::vector<unsigned char> &png, std::string &error);
+
+#endif
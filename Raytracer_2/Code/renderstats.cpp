@@ -0,0 +1,40 @@
+#include "renderstats.h"
+
+#include <iostream>
+
+using namespace std;
+
+void RenderStats::merge(RenderStats const &other)
+{
+    primaryRays += other.primaryRays;
+    reflectionRays += other.reflectionRays;
+    shadowRays += other.shadowRays;
+    occluderCacheHits += other.occluderCacheHits;
+    occluderCacheMisses += other.occluderCacheMisses;
+}
+
+void RenderStats::print(ostream &out) const
+{
+    out << "Trace time:      " << traceSeconds << " s\n"
+        << "Primary rays:    " << primaryRays << '\n'
+        << "Reflection rays: " << reflectionRays << '\n'
+        << "Shadow rays:     " << shadowRays << '\n';
+
+    if (denoiseSeconds != 0)
+        out << "Denoise time:    " << denoiseSeconds << " s\n";
+
+    uint64_t const pages = pageHits + pageMisses;
+    if (pages != 0)
+        out << "Mesh pages:      " << pageHits << " hits, " << pageMisses
+            << " misses (" << 100.0 * pageHits / pages << "% hit rate)\n";
+
+    uint64_t tested = occluderCacheHits + occluderCacheMisses;
+    if (tested == 0)
+        return;
+
+    out << "Occluder cache:  " << occluderCacheHits << " hits, "
+        << occluderCacheMisses << " misses ("
+        << 100.0 * occluderCacheHits / tested << "% hit rate, "
+        << 100.0 * occluderCacheHits / shadowRays
+        << "% of shadow rays)\n";
+}
@@ -0,0 +1,32 @@
+#ifndef RENDERSTATS_H_
+#define RENDERSTATS_H_
+
+#include <cstdint>
+#include <iosfwd>
+
+// Counters gathered while rendering. Every thread fills its own copy,
+// they are merged when the frame is done.
+struct RenderStats
+{
+    uint64_t primaryRays = 0;
+    uint64_t reflectionRays = 0;
+    uint64_t shadowRays = 0;
+
+    // shadow rays answered by the last occluder of their light
+    uint64_t occluderCacheHits = 0;
+    // shadow rays that had a cached occluder, but it did not block them
+    uint64_t occluderCacheMisses = 0;
+
+    // mesh pages found in memory and read from disk, for the whole frame,
+    // not merged
+    uint64_t pageHits = 0;
+    uint64_t pageMisses = 0;
+
+    double traceSeconds = 0;    // wall time of the whole frame, not merged
+    double denoiseSeconds = 0;  // wall time of the denoiser, not merged
+
+    void merge(RenderStats const &other);
+    void print(std::ostream &out) const;
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <cstdint>
+
+// Small, fast pseudo random generator (xorshift64*). Every pixel reseeds
+// it with its own index, so renders are deterministic.
+class Rng
+{
+    uint64_t d_state;
+
+    public:
+        explicit Rng(uint64_t seed = 1)
+        {
+            reseed(seed);
+        }
+
+        void reseed(uint64_t seed)
+        {
+            // splitmix64 step, so neighbouring seeds give unrelated streams
+            uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            d_state = (z ^ (z >> 31)) | 1;
+        }
+
+        uint64_t nextInt()
+        {
+            d_state ^= d_state >> 12;
+            d_state ^= d_state << 25;
+            d_state ^= d_state >> 27;
+            return d_state * 0x2545F4914F6CDD1DULL;
+        }
+
+        // uniform in [0, 1)
+        double next()
+        {
+            return (nextInt() >> 11) * (1.0 / 9007199254740992.0);
+        }
+};
+
+#endif
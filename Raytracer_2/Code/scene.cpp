@@ -1,46 +1,190 @@
 #include "scene.h"
 
+#include "allocationcount.h"
+#include "denoiser.h"
 #include "hit.h"
 #include "image.h"
 #include "material.h"
+#include "memoryusage.h"
 #include "ray.h"
+#include "threadpool.h"
 
+#include "timeline.h"
+
+#include "shapes/sphere.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <iostream>
 #include <limits>
+#include <mutex>
 
 using namespace std;
 
-void Scene::findHitObject(Ray const &ray, ObjectPtr *obj, Hit *min_hit)
+unsigned const Scene::MAX_IMAGE_SIZE;
+
+namespace
 {
-    findHitObject(ray, obj, min_hit, nullptr);
+    unsigned const TILE_SIZE = 32;  // pixels, the unit of work per thread
+
+    // camera, reflection and shadow rays
+    uint64_t raysCast(RenderStats const &stats)
+    {
+        return stats.primaryRays + stats.reflectionRays + stats.shadowRays;
+    }
+
+    // interleaved bits of x and y
+    uint32_t mortonCode(uint32_t x, uint32_t y)
+    {
+        uint32_t code = 0;
+        for (unsigned bit = 0; bit != 16; ++bit) {
+            code |= (x >> bit & 1) << (2 * bit);
+            code |= (y >> bit & 1) << (2 * bit + 1);
+        }
+        return code;
+    }
 }
 
-void Scene::findHitObject(Ray const &ray, ObjectPtr *obj, Hit *min_hit, 
-    ObjectPtr exclusion)
+void Scene::findHitObject(Ray const &ray, Object **obj, Hit *min_hit,
+    Object const *exclusion)
 {
-    for (unsigned idx = 0; idx != objects.size(); ++idx) {
-        Hit hit(objects[idx]->intersect(ray));
-        if (hit.t < min_hit->t && objects[idx] != exclusion) {
+    if (useGrid) {
+        SphereBatch const &spheres = grid.spheres();
+        grid.traverse(ray, min_hit->t,
+            [&](Object *const *cell, unsigned count, unsigned firstBlock,
+                unsigned lastBlock) {
+                int const idx = spheres.closest(ray, min_hit, exclusion,
+                                                firstBlock, lastBlock);
+                if (idx >= 0)
+                    *obj = objects[idx];
+
+                for (unsigned idx = 0; idx != count; ++idx) {
+                    if (cell[idx] == exclusion)
+                        continue;
+                    Hit hit(cell[idx]->intersect(ray));
+                    if (hit.t < min_hit->t) {
+                        *min_hit = hit;
+                        *obj = cell[idx];
+                    }
+                }
+            });
+        return;
+    }
+
+    int idx = sphereBatch.closest(ray, min_hit, exclusion);
+    if (idx >= 0)
+        *obj = objects[idx];
+
+    for (Object *object : unbatched) {
+        Hit hit(object->intersect(ray));
+        if (hit.t < min_hit->t && object != exclusion) {
             *min_hit = hit;
-            *obj = objects[idx];
+            *obj = object;
         }
     }
 }
 
-Color Scene::trace(Ray const &ray, int currentDepth)
+bool Scene::occluded(Ray const &ray, double maxT, Object const *self,
+    unsigned lightIdx, TraceContext &ctx)
+{
+    ++ctx.stats.shadowRays;
+
+    // a convex object cannot shadow itself, others are tested up to just
+    // before the shading point on them
+    Object const *skip = self && self->convex() ? self : nullptr;
+    double const selfT = maxT * (1 - 1e-7);
+
+    Object *&cached = ctx.occluders[lightIdx];
+    if (cached && cached != skip) {
+        if (cached->intersect(ray).t < (cached == self ? selfT : maxT)) {
+            ++ctx.stats.occluderCacheHits;
+            if (ctx.record)
+                ctx.record->addObject(cached->id);
+            return true;
+        }
+        ++ctx.stats.occluderCacheMisses;
+    }
+
+    if (useGrid) {
+        // a blocker ends the walk by lowering its limit below any cell
+        double limit = maxT;
+        SphereBatch const &spheres = grid.spheres();
+        grid.traverse(ray, limit,
+            [&](Object *const *cell, unsigned count, unsigned firstBlock,
+                unsigned lastBlock) {
+                int const idx = spheres.occluded(ray, maxT, self, cached,
+                                                 firstBlock, lastBlock);
+                if (idx >= 0) {
+                    cached = objects[idx];
+                    limit = -1;
+                    return;
+                }
+
+                for (unsigned idx = 0; idx != count; ++idx) {
+                    Object *object = cell[idx];
+                    if (object == skip || object == cached)
+                        continue;
+
+                    if (object->intersect(ray).t
+                        < (object == self ? selfT : maxT))
+                    {
+                        cached = object;
+                        limit = -1;
+                        return;
+                    }
+                }
+            });
+        if (limit < 0 && ctx.record)
+            ctx.record->addObject(cached->id);
+        return limit < 0;
+    }
+
+    int idx = sphereBatch.occluded(ray, maxT, self, cached);
+    if (idx >= 0) {
+        cached = objects[idx];
+        if (ctx.record)
+            ctx.record->addObject(idx);
+        return true;
+    }
+
+    for (Object *object : unbatched) {
+        if (object == skip || object == cached)
+            continue;
+
+        if (object->intersect(ray).t < (object == self ? selfT : maxT)) {
+            cached = object;
+            if (ctx.record)
+                ctx.record->addObject(object->id);
+            return true;
+        }
+    }
+    return false;
+}
+
+Color Scene::trace(Ray const &ray, int currentDepth, TraceContext &ctx)
 {
     // Find hit object and distance
     Hit min_hit(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj = nullptr;
+    Object *obj = nullptr;
     findHitObject(ray, &obj, &min_hit);
 
     // No hit? Return background color.
-    if (!obj) return Color(0.0, 0.0, 0.0);
+    if (!obj) {
+        if (ctx.guide && currentDepth == 0)
+            ctx.guide->add(Color(), Vector(), 0);
+        return Color(0.0, 0.0, 0.0);
+    }
 
     Material &material = obj->material;        //the hit objects material
     Point hit = ray.at(min_hit.t - 1e-15);      //the hit point
-    Vector V = -ray.D;
     Vector N = min_hit.N;
+    N.normalize();
+
+    if (ctx.record)
+        ctx.record->addHit(obj->id, hit);
 
     /****************************************************
     * This is where you should insert the color
@@ -60,43 +204,59 @@ Color Scene::trace(Ray const &ray, int currentDepth)
     *        pow(a,b)           a to the power of b
     ****************************************************/
 
+    // the material is shared between threads, so the texture color is
+    // kept here
+    Color color = material.color;
     if (material.isTextured()) {
-        material.color = obj->colorAtTexture(hit, obj->isRotated());
+        color = obj->colorAtTexture(hit, obj->isRotated());
     }
+    if (ctx.guide && currentDepth == 0)
+        ctx.guide->add(color, N, min_hit.t);
 
     // Ia is constant, other terms not
-    Color Ia = material.color * material.ka;
-    Color Is;
-    Color Id;
-
-    for (auto const light : lights) {
-        // book pg 82
-        Vector l = light->position - hit;
-        l.normalize();
-        N.normalize();
-
-        // shadows obj that is potentially hit
-        ObjectPtr obj_shad = nullptr;
-
-        if (shadows) {
-            Ray ray_shad(light->position, -l);
-            Hit min_hit_shad(numeric_limits<double>::infinity(), Vector());
-            findHitObject(ray_shad, &obj_shad, &min_hit_shad);
+    Color Ia = color * material.ka;
+
+    // the lights that reach the hit and their weights, then shaded
+    // together
+    unsigned count = 0;
+    double total = 0;
+    auto reach = [&](unsigned lightIdx, double weight) {
+        weight *= shadowFactor(lightIdx, hit, obj, ctx);
+        if (weight == 0)
+            return;
+        ctx.shadeLights[count] = lightIdx;
+        ctx.shadeWeights[count++] = weight;
+        total += weight;
+    };
+
+    if (lightSamples == 0 || lightSamples >= lights.size()) {
+        // exact: every light gets a shadow ray
+        for (unsigned idx = 0; idx != lights.size(); ++idx)
+            reach(idx, 1.0);
+    } else {
+        // pick lightSamples lights proportional to their power, weight
+        // each by 1 / (samples * pdf) to keep the estimate unbiased
+        for (unsigned idx = 0; idx != lightSamples; ++idx) {
+            double pdf;
+            unsigned pick = lightSampler.sample(ctx.rng.next(), pdf);
+            reach(pick, 1.0 / (lightSamples * pdf));
         }
+    }
 
-        if (!shadows || (shadows && obj_shad == obj)) {
-            // book pg 238
-            Vector r = -l + 2 * l.dot(N) * N;
-            // Is - Specular reflection (lecture slides)
-            // material.n resembles Phong specular component p
-            Is += pow(fmax(0, r.dot(V)), material.n) * material.ks * light->color;
-            // Id - Diffuse term - Lambert's law (lecture slides)
-            Id += fmax(0, N.dot(l)) * material.color * material.kd * light->color;
-
-            if (currentDepth < recursionDepth) {
-                Is += traceRefl(ray, currentDepth, obj, min_hit);
-            }
-        }
+    // book pg 238: Is - Specular reflection, Id - Diffuse term (Lambert's
+    // law), see lecture slides. material.n resembles Phong specular
+    // component p
+    Color diffuse;
+    Color specular;
+    lightBatch.shade(hit, N, -ray.D, material.n, ctx.shadeLights.data(),
+                     ctx.shadeWeights.data(), count, diffuse, specular);
+    Color Is = specular * material.ks;
+    Color Id = diffuse * color * material.kd;
+
+    // the reflection does not depend on the light, it counts once for
+    // every light that reaches the hit
+    if (currentDepth < recursionDepth && count != 0) {
+        Is += total * traceRefl(ray, currentDepth, obj, min_hit, ctx);
     }
 
     // add up all terms
@@ -104,7 +264,62 @@ Color Scene::trace(Ray const &ray, int currentDepth)
     return I;
 }
 
-Color Scene::traceRefl(Ray ray, int depth, ObjectPtr obj, Hit min_hit)
+double Scene::shadowFactor(unsigned lightIdx, Point const &hit, Object *obj,
+    TraceContext &ctx)
+{
+    Light const &light = *lights[lightIdx];
+
+    if (ctx.record)
+        ctx.record->addLight(lightIdx);
+    if (!shadows)
+        return 1;
+
+    // shadow ray from the light towards the hit point, anything in between
+    // other than the object itself puts it in the shadow. Area lights may
+    // be partly hidden.
+    if (light.isArea())
+        return visibility(light, lightIdx, hit, obj, ctx);
+
+    Vector l = hit - light.position;
+    double dist = l.length();
+    l *= 1.0 / dist;
+    return occluded(Ray(light.position, l), dist, obj, lightIdx, ctx) ? 0 : 1;
+}
+
+double Scene::visibility(Light const &light, unsigned lightIdx,
+    Point const &hit, Object *obj, TraceContext &ctx)
+{
+    unsigned const n = light.strata;
+
+    // is a jittered point in stratum (sx, sy) of the light visible?
+    auto visible = [&](unsigned sx, unsigned sy) {
+        double const u = (sx + ctx.rng.next()) / n;
+        double const v = (sy + ctx.rng.next()) / n;
+        Point const from = light.sample(hit, u, v);
+        Vector const D = hit - from;
+        double const dist = D.length();
+        return !occluded(Ray(from, D / dist), dist, obj, lightIdx, ctx);
+    };
+
+    // the corner strata first: when they agree the point is most likely
+    // fully lit or fully in the shadow, and that costs 4 rays
+    unsigned const last = n - 1;
+    unsigned const corners = visible(0, 0) + visible(last, 0)
+        + visible(0, last) + visible(last, last);
+    if (n <= 2 || corners == 0 || corners == 4)
+        return corners / 4.0;
+
+    // penumbra: every other stratum as well
+    unsigned lit = corners;
+    for (unsigned sy = 0; sy != n; ++sy)
+        for (unsigned sx = 0; sx != n; ++sx)
+            if ((sx != 0 && sx != last) || (sy != 0 && sy != last))
+                lit += visible(sx, sy);
+    return lit / double(n * n);
+}
+
+Color Scene::traceRefl(Ray const &ray, int depth, Object *obj,
+                       Hit const &min_hit, TraceContext &ctx)
 {
     // calc hitpoint
     Point hit = ray.at(min_hit.t - 1e-15); //the hit point
@@ -113,9 +328,12 @@ Color Scene::traceRefl(Ray ray, int depth, ObjectPtr obj, Hit min_hit)
 
     // new ray
     Ray ray_refl{ hit, r };
+    ++ctx.stats.reflectionRays;
+    if (ctx.record)
+        ctx.record->reflects = true;
     // Find hit object and distance
     Hit min_hit_reflected(numeric_limits<double>::infinity(), Vector());
-    ObjectPtr obj_hit_refl = nullptr;
+    Object *obj_hit_refl = nullptr;
     findHitObject(ray_refl, &obj_hit_refl, &min_hit_reflected, obj);
 
     Material& material = obj->material;
@@ -124,75 +342,338 @@ Color Scene::traceRefl(Ray ray, int depth, ObjectPtr obj, Hit min_hit)
     // Return background color.if no object reflected hit
     if (!obj_hit_refl) return Color(0.0, 0.0, 0.0);
 
+    if (ctx.record)
+        ctx.record->addObject(obj_hit_refl->id);
+
     Point hit_refl = ray_refl.at(min_hit_reflected.t - 1e-15);
     
-    // recurse into another trace
-    Light light_refl(hit_refl, trace(ray_refl, depth + 1) * material.ks);
-    Vector L = (light_refl.position - hit).normalized();
+    // recurse into another trace, the reflected point acts as a light
+    Color reflected = trace(ray_refl, depth + 1, ctx) * material.ks;
+    Vector L = (hit_refl - hit).normalized();
     r = N * 2 * (N.dot(L)) - L;
 
     Color Is;
 
-    Is += pow(fmax(0, r.dot(V)), material.n) * material.ks * light_refl.color;
+    Is += pow(fmax(0, r.dot(V)), material.n) * material.ks * reflected;
     
     // add up all terms
     Color I =  Is;
     return I;
 }
 
-void Scene::render(Image &img)
+void Scene::prepare()
 {
-    unsigned w = img.width();
-    unsigned h = img.height();
+    if (prepared)
+        return;
+
+    MemoryUsage::Scope const scope(MemoryUsage::ACCELERATION);
+    Timeline::Scope const event("build");
+    buildLightSampler();
+    buildLightBatch();
+    if (useGrid) {
+        sphereBatch.clear();
+        unbatched.clear();
+        grid.build(objects, gridDensity, sphereBatching);
+    } else {
+        buildSphereBatch();
+        grid.clear();
+    }
+    prepared = true;
+}
 
-    float thr = 0.5;
-    float add = 1.0;
+RenderStats Scene::render(Image &img, ThreadPool &pool, CostMap *costs)
+{
+    prepare();
+    auto const start = chrono::steady_clock::now();
+
+    CropWindow const window = cropWindow();
+    unsigned const tilesX = (window.x1 - window.x0 + TILE_SIZE - 1)
+        / TILE_SIZE;
+    unsigned const tilesY = (window.y1 - window.y0 + TILE_SIZE - 1)
+        / TILE_SIZE;
+    unsigned const tiles = tilesX * tilesY;
+
+    // tiles in Z order: tiles rendered around the same time are close
+    // together, so they tend to need the same mesh pages
+    vector<unsigned> order(tiles);
+    for (unsigned tile = 0; tile != tiles; ++tile)
+        order[tile] = tile;
+    sort(order.begin(), order.end(), [=](unsigned lhs, unsigned rhs) {
+        return mortonCode(lhs % tilesX, lhs / tilesX)
+            < mortonCode(rhs % tilesX, rhs / tilesX);
+    });
+
+    uint64_t const pageHits = pageCache->hits();
+    uint64_t const pageMisses = pageCache->misses();
+
+    // first hits of the camera rays, to guide the denoiser
+    Denoiser denoiser;
+    if (denoise) {
+        MemoryUsage::Scope const scope(MemoryUsage::FRAMEBUFFER);
+        denoiser.resize(width(), height());
+    }
 
-    for (float i = thr / samplingFactor; i < h; i += add / samplingFactor) {
-        for (float j = thr / samplingFactor; j < w; j += add / samplingFactor) {
-            Point pixel(thr + i, thr + (h - j - 1), 0);
-            Ray ray(eye, (pixel - eye).normalized());
-            Color col = trace(ray, 0);
-            col.clamp();
-            
-            int width = (int) i; // cast float to int
-            int height = (int) j; // cast float to int
-            img(width, height) += col / (samplingFactor * samplingFactor);
+    // per pixel time costs two clock reads, rays only three additions
+    bool const timed = costs && costs->metric() == CostMap::TIME;
+
+    atomic<unsigned> nextTile(0);
+    mutex statsMutex;
+    RenderStats stats;
+
+    // every worker takes tiles until none are left
+    pool.run([&](unsigned) {
+        TraceContext ctx;
+        ctx.reset(lights.size());
+        PixelGuide guide;
+        if (denoise)
+            ctx.guide = &guide;
+
+        for (unsigned next = nextTile++; next < tiles; next = nextTile++) {
+            unsigned const tile = order[next];
+            unsigned const x0 = window.x0 + (tile % tilesX) * TILE_SIZE;
+            unsigned const y0 = window.y0 + (tile / tilesX) * TILE_SIZE;
+            unsigned const x1 = min(x0 + TILE_SIZE, window.x1);
+            unsigned const y1 = min(y0 + TILE_SIZE, window.y1);
+            Timeline::Scope const event("tile", x0, y0);
+            unsigned long long const allocations = allocationCount();
+
+            for (unsigned y = y0; y < y1; ++y) {
+                Image::Row row = img.row(y);
+                for (unsigned x = x0; x < x1; ++x) {
+                    uint64_t const rays = raysCast(ctx.stats);
+                    chrono::steady_clock::time_point begin;
+                    if (timed)
+                        begin = chrono::steady_clock::now();
+                    row.put(x, renderPixel(x, y, ctx));
+                    if (costs)
+                        costs->put(x, y, timed
+                            ? chrono::duration<float, nano>(
+                                chrono::steady_clock::now() - begin).count()
+                            : raysCast(ctx.stats) - rays);
+                    if (denoise)
+                        denoiser.put(x, y, guide);
+                }
+            }
+
+            // tracing must not allocate (checked in COUNT_ALLOCATIONS builds)
+            if (allocationCount() != allocations) {
+                cerr << "Tracing tile (" << x0 << ", " << y0 << ") made "
+                     << allocationCount() - allocations
+                     << " heap allocations.\n";
+                abort();
+            }
         }
+
+        lock_guard<mutex> lock(statsMutex);
+        stats.merge(ctx.stats);
+    });
+
+    stats.traceSeconds = chrono::duration<double>(
+        chrono::steady_clock::now() - start).count();
+    if (denoise) {
+        auto const traced = chrono::steady_clock::now();
+        MemoryUsage::Scope const scope(MemoryUsage::FRAMEBUFFER);
+        Timeline::Scope const event("denoise");
+        denoiser.filter(img, window, pool);
+        stats.denoiseSeconds = chrono::duration<double>(
+            chrono::steady_clock::now() - traced).count();
     }
+    stats.pageHits = pageCache->hits() - pageHits;
+    stats.pageMisses = pageCache->misses() - pageMisses;
+    return stats;
 }
 
-// --- Misc functions ----------------------------------------------------------
+RenderStats Scene::renderPixels(Image &img, vector<unsigned> const &pixels,
+    vector<PixelRecord> &records, ThreadPool &pool, Denoiser *denoiser)
+{
+    prepare();
+
+    unsigned const w = img.width();
+    unsigned const chunk = TILE_SIZE * TILE_SIZE;
+    atomic<unsigned> next(0);
+    mutex statsMutex;
+    RenderStats stats;
+
+    pool.run([&](unsigned) {
+        TraceContext ctx;
+        ctx.reset(lights.size());
+        PixelGuide guide;
+        if (denoiser)
+            ctx.guide = &guide;
+
+        for (unsigned begin = next.fetch_add(chunk); begin < pixels.size();
+             begin = next.fetch_add(chunk))
+        {
+            unsigned const end = min<size_t>(begin + chunk, pixels.size());
+            for (unsigned idx = begin; idx != end; ++idx) {
+                unsigned const pixel = pixels[idx];
+                ctx.record = &records[pixel];
+                ctx.record->clear();
+                img.row(pixel / w).put(pixel % w,
+                    renderPixel(pixel % w, pixel / w, ctx));
+                if (denoiser)
+                    denoiser->put(pixel % w, pixel / w, guide);
+            }
+        }
+
+        lock_guard<mutex> lock(statsMutex);
+        stats.merge(ctx.stats);
+    });
+
+    return stats;
+}
 
-void Scene::addObject(ObjectPtr obj)
+Color Scene::renderPixel(unsigned x, unsigned y, TraceContext &ctx)
 {
-    objects.push_back(obj);
+    unsigned const factor = samplingFactor;
+    Color col;
+    if (ctx.guide)
+        ctx.guide->clear();
+
+    for (unsigned sx = 0; sx != factor; ++sx) {
+        for (unsigned sy = 0; sy != factor; ++sy) {
+            // subsample coordinates over the whole image
+            uint64_t const i = x * factor + sx;
+            uint64_t const j = y * factor + sy;
+
+            // one stream per subsample, independent of traversal order
+            ctx.rng.reseed(i << 32 | j);
+
+            Ray ray(camera.ray((i + 0.5) / factor, (j + 0.5) / factor));
+            ++ctx.stats.primaryRays;
+            Color sample = trace(ray, 0, ctx);
+            sample.clamp();
+            col += sample / (factor * factor);
+        }
+    }
+    return col;
 }
 
+// --- Misc functions ----------------------------------------------------------
+
 void Scene::addLight(Light const &light)
 {
-    lights.push_back(LightPtr(new Light(light)));
+    lights.push_back(arena->make<Light>(light));
+    prepared = false;
 }
 
 void Scene::setEye(Triple const &position)
 {
-    eye = position;
+    camera.eye = position;
+    camera.update();
 }
 
-unsigned Scene::getNumObject()
+void Scene::setCamera(Camera const &cam)
+{
+    camera = cam;
+}
+
+void Scene::setImageSize(unsigned width, unsigned height)
+{
+    camera.width = width;
+    camera.height = height;
+    camera.update();
+}
+
+void Scene::setCropWindow(CropWindow const &window)
+{
+    cropped = true;
+    crop = window;
+}
+
+unsigned Scene::width() const
+{
+    return camera.width;
+}
+
+unsigned Scene::height() const
+{
+    return camera.height;
+}
+
+bool Scene::hasCropWindow() const
+{
+    return cropped;
+}
+
+unsigned Scene::getNumObject() const
 {
     return objects.size();
 }
 
-unsigned Scene::getNumLights()
+unsigned Scene::getNumLights() const
 {
     return lights.size();
 }
 
+Object *Scene::getObject(unsigned idx) const
+{
+    return objects[idx];
+}
+
+Light const &Scene::getLight(unsigned idx) const
+{
+    return *lights[idx];
+}
+
+Camera const &Scene::getCamera() const
+{
+    return camera;
+}
+
+bool Scene::hasShadows() const
+{
+    return shadows;
+}
+
+bool Scene::hasSRGBOutput() const
+{
+    return srgb;
+}
+
+bool Scene::denoises() const
+{
+    return denoise;
+}
+
+unsigned Scene::lightSampleCount() const
+{
+    return lightSamples;
+}
+
+unsigned Scene::costMapMetric() const
+{
+    return costMetric;
+}
+
+CropWindow Scene::cropWindow() const
+{
+    CropWindow window{ 0, 0, camera.width, camera.height };
+    if (cropped) {
+        window.x0 = min(crop.x0, camera.width);
+        window.y0 = min(crop.y0, camera.height);
+        window.x1 = min(crop.x1, camera.width);
+        window.y1 = min(crop.y1, camera.height);
+    }
+    return window;
+}
+
 void Scene::setShadows(bool shad) {
     shadows = shad;
 }
 
+void Scene::setSRGBOutput(bool encode) {
+    srgb = encode;
+}
+
+void Scene::setDenoise(bool filter) {
+    denoise = filter;
+}
+
+void Scene::setCostMapMetric(unsigned metric) {
+    costMetric = metric;
+}
+
 void Scene::setRecursionDepth(int depth) {
     recursionDepth = depth;
 }
@@ -200,4 +681,106 @@ void Scene::setRecursionDepth(int depth) {
 void Scene::setSamplingFactor(int factor)
 {
     samplingFactor = factor;
+}
+
+void Scene::setLightSamples(unsigned samples)
+{
+    lightSamples = samples;
+    prepared = false;
+}
+
+void Scene::setSphereBatching(bool batching)
+{
+    sphereBatching = batching;
+    prepared = false;
+}
+
+void Scene::setGrid(bool grid, double density)
+{
+    useGrid = grid;
+    gridDensity = density;
+    prepared = false;
+}
+
+void Scene::setMeshMemory(size_t bytes)
+{
+    pageCache->setBudget(bytes);
+}
+
+PageCache &Scene::meshPages()
+{
+    return *pageCache;
+}
+
+void Scene::setMeshCache(string const &directory)
+{
+    meshCache = directory;
+}
+
+string const &Scene::meshCacheDir() const
+{
+    return meshCache;
+}
+
+void Scene::setFastMeshBuild(bool fast)
+{
+    fastMeshBuild = fast;
+}
+
+bool Scene::fastMeshBuilds() const
+{
+    return fastMeshBuild;
+}
+
+void Scene::setLazyMeshBuild(bool lazy)
+{
+    lazyMeshBuild = lazy;
+}
+
+bool Scene::lazyMeshBuilds() const
+{
+    return lazyMeshBuild;
+}
+
+void Scene::setMeshBuildMemory(size_t bytes)
+{
+    buildMemory = bytes;
+}
+
+size_t Scene::meshBuildMemory() const
+{
+    return buildMemory;
+}
+
+void Scene::buildLightBatch()
+{
+    lightBatch.clear();
+    for (Light const *light : lights)
+        lightBatch.add(*light);
+}
+
+void Scene::buildSphereBatch()
+{
+    sphereBatch.clear();
+    unbatched.clear();
+
+    for (unsigned idx = 0; idx != objects.size(); ++idx) {
+        Sphere *sphere = dynamic_cast<Sphere *>(objects[idx]);
+        if (sphereBatching && sphere)
+            sphereBatch.add(sphere, idx);
+        else
+            unbatched.push_back(objects[idx]);
+    }
+}
+
+void Scene::buildLightSampler()
+{
+    // a point light's contribution does not fall off with distance, so
+    // its power alone is a good importance estimate
+    vector<double> weights;
+    weights.reserve(lights.size());
+    for (auto const &light : lights)
+        weights.push_back(light->color.r + light->color.g + light->color.b);
+
+    lightSampler.build(weights);
 }
\ No newline at end of file
@@ -1,49 +1,193 @@
 #ifndef SCENE_H_
 #define SCENE_H_
 
+#include "arena.h"
+#include "camera.h"
+#include "costmap.h"
+#include "grid.h"
 #include "light.h"
+#include "lightbatch.h"
+#include "lightsampler.h"
 #include "object.h"
+#include "pagecache.h"
+#include "renderstats.h"
+#include "tracecontext.h"
 #include "triple.h"
 
+#include "shapes/spherebatch.h"
+
+#include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 // Forward declarations
+class Denoiser;
 class Ray;
 class Image;
+class ThreadPool;
+
+// pixel region [x0, x1) x [y0, y1)
+struct CropWindow
+{
+    unsigned x0;
+    unsigned y0;
+    unsigned x1;
+    unsigned y1;
+};
 
 class Scene
 {
-    std::vector<ObjectPtr> objects;
-    std::vector<LightPtr> lights;   // no ptr needed, but kept for consistency
-    Point eye;
+    // pages of meshes, shared by copies like the objects using it
+    std::shared_ptr<PageCache> pageCache = std::make_shared<PageCache>();
+    std::string meshCache;          // directory for page files, or empty
+    bool fastMeshBuild = false;     // median splits, for previews
+    bool lazyMeshBuild = false;     // mesh pages built when first hit
+    size_t buildMemory = size_t(1) << 30;   // for mesh pages, beyond it
+                                            // they are built out of core
+
+    // objects and lights live in the arena, in parse order. Copies of the
+    // scene share them; they are released with the last copy.
+    std::shared_ptr<Arena> arena = std::make_shared<Arena>();
+    std::vector<Object *> objects;
+    std::vector<Light *> lights;
+    Camera camera;
+    bool cropped = false;
+    CropWindow crop;
     bool shadows = false;
+    bool srgb = false;              // images are written sRGB encoded
+    bool denoise = false;           // filter the image after tracing
+    unsigned costMetric = CostMap::NONE;    // of the cost map written
     int recursionDepth = 0;
     int samplingFactor = 1;
+    unsigned lightSamples = 0;      // shadow rays per hit, 0 = every light
+    LightSampler lightSampler;
+    LightBatch lightBatch;          // lights packed for shading
+    bool sphereBatching = true;
+    bool useGrid = false;           // instead of testing every object
+    double gridDensity = 2;         // cells per object
+
+    // built by prepare() from objects: spheres are packed for the SIMD
+    // kernel, everything else is tested one by one, or all of them are
+    // put in the grid. Kept until the scene changes, so copies of a
+    // prepared scene render right away.
+    bool prepared = false;
+    SphereBatch sphereBatch;
+    std::vector<Object *> unbatched;
+    Grid grid;
 
     public:
+        static unsigned const MAX_IMAGE_SIZE = 16384;   // pixels a side
+
+        // trace a ray into the scene and return the color. Tracing uses
+        // plain pointers to the objects and does not allocate.
+        Color trace(Ray const &ray, int currentDepth, TraceContext &ctx);
+        Color traceRefl(Ray const &ray, int currentDepth, Object *obj,
+                        Hit const &min_hit, TraceContext &ctx);
+
+        void findHitObject(Ray const &ray, Object **obj, Hit *min_hit,
+                           Object const *exclusion = nullptr);
+
+        // does anything but self block ray before maxT? The shadow ray
+        // towards light lightIdx first tests that light's last occluder.
+        bool occluded(Ray const &ray, double maxT, Object const *self,
+                      unsigned lightIdx, TraceContext &ctx);
 
-        // trace a ray into the scene and return the color
-        Color trace(Ray const &ray, int currentDepth);
-        Color traceRefl(Ray ray, int currentDepth, ObjectPtr obj, Hit min_hit);
+        // build what rendering needs (done by render when required)
+        void prepare();
 
-        void findHitObject(Ray const &ray, ObjectPtr *obj, Hit *min_hit);
-        void findHitObject(Ray const &ray, ObjectPtr *obj, Hit *min_hit, 
-                            ObjectPtr exclusion);
+        // render the scene (or only its crop window) to the given image,
+        // in tiles spread over the pool's threads, then denoise it when
+        // asked to. With costs (sized like img), the cost of every pixel
+        // rendered is put there.
+        RenderStats render(Image &img, ThreadPool &pool,
+                           CostMap *costs = nullptr);
 
-        // render the scene to the given image
-        void render(Image &img);
+        // average of the supersamples of pixel (x, y), clamped
+        Color renderPixel(unsigned x, unsigned y, TraceContext &ctx);
 
+        // render only the given pixels (y * width + x), recording what each
+        // of them depends on in records (one per image pixel) and, with a
+        // denoiser, what their camera rays hit in it
+        RenderStats renderPixels(Image &img,
+                                 std::vector<unsigned> const &pixels,
+                                 std::vector<PixelRecord> &records,
+                                 ThreadPool &pool,
+                                 Denoiser *denoiser = nullptr);
 
-        void addObject(ObjectPtr obj);
+
+        // construct a Shape in the scene, returned to set its material
+        template <typename Shape, typename... Args>
+        Shape *addObject(Args &&...args);
         void addLight(Light const &light);
         void setEye(Triple const& position);
+        void setCamera(Camera const &cam);
+        void setImageSize(unsigned width, unsigned height);
+        void setCropWindow(CropWindow const &window);
+
+        unsigned width() const;
+        unsigned height() const;
+        bool hasCropWindow() const;
 
-        unsigned getNumObject();
-        unsigned getNumLights();
+        unsigned getNumObject() const;
+        unsigned getNumLights() const;
+        Object *getObject(unsigned idx) const;
+        Light const &getLight(unsigned idx) const;
+        Camera const &getCamera() const;
+        bool hasShadows() const;
+        bool hasSRGBOutput() const;
+        bool denoises() const;
+        unsigned lightSampleCount() const;  // 0: every light
+        unsigned costMapMetric() const;
+        CropWindow cropWindow() const;  // whole image without crop window
 
         void setShadows(bool shadows);
+        void setSRGBOutput(bool srgb);
+        void setDenoise(bool denoise);
+        void setCostMapMetric(unsigned metric);     // CostMap::NONE: none
         void setRecursionDepth(int depth);
         void setSamplingFactor(int factor);
+        void setLightSamples(unsigned samples);
+        void setSphereBatching(bool batching);
+        void setGrid(bool grid, double density = 2);
+        void setMeshMemory(size_t bytes);   // for meshes added later
+        PageCache &meshPages();
+        void setMeshCache(std::string const &directory);
+        std::string const &meshCacheDir() const;
+        void setFastMeshBuild(bool fast);
+        bool fastMeshBuilds() const;
+        void setLazyMeshBuild(bool lazy);
+        bool lazyMeshBuilds() const;
+        void setMeshBuildMemory(size_t bytes);
+        size_t meshBuildMemory() const;
+
+    private:
+
+        // how much of light lightIdx hit on obj receives: 1 without
+        // shadows, otherwise 0 or 1 from a shadow ray, or the visibility of
+        // an area light
+        double shadowFactor(unsigned lightIdx, Point const &hit, Object *obj,
+                            TraceContext &ctx);
+
+        // fraction of area light (index lightIdx) that hit on obj sees,
+        // from stratified shadow rays: 4 first, all strata when those
+        // disagree
+        double visibility(Light const &light, unsigned lightIdx,
+                          Point const &hit, Object *obj, TraceContext &ctx);
+
+        void buildLightSampler();
+        void buildLightBatch();
+        void buildSphereBatch();
 };
 
+template <typename Shape, typename... Args>
+Shape *Scene::addObject(Args &&...args)
+{
+    Shape *obj = arena->make<Shape>(std::forward<Args>(args)...);
+    obj->id = objects.size();
+    objects.push_back(obj);
+    prepared = false;
+    return obj;
+}
+
 #endif
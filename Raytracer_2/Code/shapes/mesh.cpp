@@ -0,0 +1,951 @@
+#include "mesh.h"
+
+#include "../allocationcount.h"
+#include "../filetime.h"
+#include "../hash.h"
+#include "../memoryusage.h"
+#include "../pagecache.h"
+#include "../tasks.h"
+#include "../timeline.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cfloat>   // DBL_EPSILON
+#include <climits>  // PATH_MAX
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace
+{
+    unsigned const LEAF_FACES = 4;
+    // nodes (fewer than half the faces) and faces of a cluster fit in a page
+    unsigned const CLUSTER_FACES = 900;
+
+    char const MAGIC[8] = { 'R', 'A', 'Y', 'M', 'E', 'S', 'H', '4' };
+    unsigned const PAGE_BATCH = 64;     // pages built at the same time
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t pageSize;
+        uint32_t pages;
+        uint32_t clusters;          // nodes of the tree over the clusters
+        uint32_t faces;
+        uint32_t fastBuild;         // median splits instead of SAH
+        uint32_t unused;
+        uint64_t geometry;          // hash of the faces and build settings
+        // the OBJ file when it was last found to have this geometry
+        int64_t modified;
+        int64_t size;
+    };
+
+    struct PageHeader
+    {
+        uint32_t nodes;
+        uint32_t faces;
+    };
+
+    // pages start at the first page boundary after the cluster tree
+    size_t pagesOffset(unsigned clusters)
+    {
+        size_t const size = sizeof(FileHeader) + clusters * sizeof(BVH::Node);
+        return (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE
+            * PageCache::PAGE_SIZE;
+    }
+
+    // --- building ------------------------------------------------------------
+
+    struct Position
+    {
+        float x;
+        float y;
+        float z;
+    };
+
+    Mesh::Face makeFace(Position const &a, Position const &b,
+                        Position const &c, BVH::Box &box)
+    {
+        float const v[3][3] = {
+            { a.x, a.y, a.z }, { b.x, b.y, b.z }, { c.x, c.y, c.z } };
+
+        Mesh::Face face;
+        for (int axis = 0; axis != 3; ++axis) {
+            face.v0[axis] = v[0][axis];
+            face.e1[axis] = v[1][axis] - v[0][axis];
+            face.e2[axis] = v[2][axis] - v[0][axis];
+            box.min[axis] = min({ v[0][axis], v[1][axis], v[2][axis] });
+            box.max[axis] = max({ v[0][axis], v[1][axis], v[2][axis] });
+        }
+        return face;
+    }
+
+    BVH::Box boundsOf(vector<BVH::Box> const &boxes,
+                      vector<unsigned> const &order, unsigned begin,
+                      unsigned end)
+    {
+        float const inf = numeric_limits<float>::infinity();
+        BVH::Box box{ { inf, inf, inf }, { -inf, -inf, -inf } };
+        for (unsigned idx = begin; idx != end; ++idx) {
+            for (int axis = 0; axis != 3; ++axis) {
+                box.min[axis] = min(box.min[axis],
+                                    boxes[order[idx]].min[axis]);
+                box.max[axis] = max(box.max[axis],
+                                    boxes[order[idx]].max[axis]);
+            }
+        }
+        return box;
+    }
+
+    // one cluster: its BVH and its faces in leaf order
+    void writePage(vector<Mesh::Face> const &faces,
+                   vector<BVH::Box> const &boxes,
+                   vector<unsigned> const &order, unsigned begin,
+                   unsigned end, bool fast, vector<char> &page)
+    {
+        vector<BVH::Box> local(end - begin);
+        for (unsigned idx = begin; idx != end; ++idx)
+            local[idx - begin] = boxes[order[idx]];
+
+        vector<unsigned> localOrder;
+        vector<BVH::Node> const nodes = BVH::build(local, LEAF_FACES,
+                                                   localOrder, fast);
+
+        if (sizeof(PageHeader) + nodes.size() * sizeof(BVH::Node)
+            + (end - begin) * sizeof(Mesh::Face) > page.size())
+            throw runtime_error("Mesh cluster does not fit in a page.");
+
+        fill(page.begin(), page.end(), 0);
+        PageHeader const header{ unsigned(nodes.size()), end - begin };
+        char *data = page.data();
+        memcpy(data, &header, sizeof header);
+        data += sizeof header;
+        memcpy(data, nodes.data(), nodes.size() * sizeof(BVH::Node));
+        data += nodes.size() * sizeof(BVH::Node);
+        for (unsigned idx : localOrder) {
+            memcpy(data, &faces[order[begin + idx]], sizeof(Mesh::Face));
+            data += sizeof(Mesh::Face);
+        }
+    }
+
+    // --- scratch files -------------------------------------------------------
+
+    // a file of its own next to path (path.XXXXXX), as other processes may
+    // share the directory: either built and then renamed to path, or
+    // scratch space that is gone once closed
+    class TempFile
+    {
+        int d_fd;
+        string d_name;
+        bool d_linked = true;
+
+        public:
+            explicit TempFile(string const &path)
+            {
+                vector<char> name(path.begin(), path.end());
+                for (char const c : string(".XXXXXX"))
+                    name.push_back(c);
+                name.push_back(0);
+                d_fd = mkstemp(name.data());
+                d_name = name.data();
+                if (d_fd < 0)
+                    throw runtime_error("Could not write " + d_name + '.');
+                fchmod(d_fd, 0644);
+            }
+
+            ~TempFile()
+            {
+                close(d_fd);
+                if (d_linked)
+                    ::unlink(d_name.c_str());
+            }
+
+            TempFile(TempFile const &) = delete;
+            TempFile &operator=(TempFile const &) = delete;
+
+            // removed from the directory now, the data lives until closed
+            void unlink()
+            {
+                ::unlink(d_name.c_str());
+                d_linked = false;
+            }
+
+            void write(void const *data, size_t size, size_t offset)
+            {
+                char const *bytes = static_cast<char const *>(data);
+                while (size != 0) {
+                    ssize_t const done = pwrite(d_fd, bytes, size, offset);
+                    if (done < 0 && errno == EINTR)
+                        continue;
+                    if (done <= 0)
+                        throw runtime_error("Could not write " + d_name
+                                            + '.');
+                    bytes += done;
+                    size -= done;
+                    offset += done;
+                }
+            }
+
+            void read(void *data, size_t size, size_t offset) const
+            {
+                char *bytes = static_cast<char *>(data);
+                while (size != 0) {
+                    ssize_t const done = pread(d_fd, bytes, size, offset);
+                    if (done < 0 && errno == EINTR)
+                        continue;
+                    if (done <= 0)
+                        throw runtime_error("Could not read " + d_name
+                                            + '.');
+                    bytes += done;
+                    size -= done;
+                    offset += done;
+                }
+            }
+
+            // flushed to disk and renamed to path
+            void commit(string const &path)
+            {
+                if (fsync(d_fd) != 0
+                    || rename(d_name.c_str(), path.c_str()) != 0)
+                    throw runtime_error("Could not write " + path + '.');
+                d_linked = false;
+            }
+    };
+
+    // a face and its bounds, as spilled to disk
+    struct Record
+    {
+        Mesh::Face face;
+        BVH::Box box;
+    };
+
+    // faces in a scratch file, in the order added, with the bounds of
+    // their box centres
+    class Spill
+    {
+        TempFile d_file;
+        vector<Record> d_buffer;
+        size_t d_count = 0;
+        BVH::Box d_centres;
+
+        public:
+            static size_t const BUFFER = 4096;      // records
+
+            explicit Spill(string const &path)
+            :
+                d_file(path)
+            {
+                d_file.unlink();
+                d_buffer.reserve(BUFFER);
+                float const inf = numeric_limits<float>::infinity();
+                d_centres = BVH::Box{ { inf, inf, inf },
+                                      { -inf, -inf, -inf } };
+            }
+
+            void add(Mesh::Face const &face, BVH::Box const &box)
+            {
+                for (int axis = 0; axis != 3; ++axis) {
+                    float const centre = (box.min[axis] + box.max[axis]) / 2;
+                    d_centres.min[axis] = min(d_centres.min[axis], centre);
+                    d_centres.max[axis] = max(d_centres.max[axis], centre);
+                }
+                d_buffer.push_back(Record{ face, box });
+                if (d_buffer.size() == BUFFER)
+                    flush();
+            }
+
+            size_t count() const
+            {
+                return d_count + d_buffer.size();
+            }
+
+            BVH::Box const &centres() const
+            {
+                return d_centres;
+            }
+
+            // visit(record) for every face, in order
+            template <typename Visit>
+            void forEach(Visit visit)
+            {
+                flush();
+                vector<Record> records(BUFFER);
+                for (size_t first = 0; first < d_count; first += BUFFER) {
+                    size_t const count = min(BUFFER, d_count - first);
+                    d_file.read(records.data(), count * sizeof(Record),
+                                first * sizeof(Record));
+                    for (size_t idx = 0; idx != count; ++idx)
+                        visit(records[idx]);
+                }
+            }
+
+        private:
+            void flush()
+            {
+                d_file.write(d_buffer.data(),
+                             d_buffer.size() * sizeof(Record),
+                             d_count * sizeof(Record));
+                d_count += d_buffer.size();
+                d_buffer.clear();
+            }
+    };
+
+    size_t const Spill::BUFFER;
+
+    // --- reading -------------------------------------------------------------
+
+    // what building a mesh in memory takes per face: the face, its box,
+    // its place in the order and the partition's work space
+    size_t const FACE_BUILD_BYTES = 128;
+
+    // the faces of an OBJ file and the hash of them and of everything that
+    // determines the page file built for them. Up to the build memory they
+    // are kept in memory, beyond that they all go to a spill file.
+    struct Triangles
+    {
+        size_t count = 0;
+        uint64_t geometry;
+        vector<Mesh::Face> faces;       // in memory
+        vector<BVH::Box> boxes;
+        unique_ptr<Spill> spill;        // otherwise
+    };
+
+    // streamed: only the vertex positions are kept while reading. Every
+    // three vertices of the faces form a triangle (as OBJLoader reads
+    // them); negative indices count back from the last vertex.
+    Triangles readFaces(string const &filename, bool fast, size_t budget,
+                        string const &spillPath)
+    {
+        ifstream in(filename);
+        if (!in)
+            throw runtime_error("Could not open " + filename + '.');
+
+        Triangles triangles;
+        Hash hash;
+        hash.add(MAGIC);
+        hash.add(PageCache::PAGE_SIZE);
+        hash.add(LEAF_FACES);
+        hash.add(CLUSTER_FACES);
+        hash.add(fast);
+
+        vector<Position> positions;
+        size_t corners[3];
+        unsigned corner = 0;
+        string line;
+        while (getline(in, line)) {
+            char const *text = line.c_str();
+            while (*text == ' ' || *text == '\t')
+                ++text;
+
+            if (text[0] == 'v' && (text[1] == ' ' || text[1] == '\t')) {
+                Position position;
+                char *end;
+                position.x = strtof(text + 1, &end);
+                position.y = strtof(end, &end);
+                position.z = strtof(end, &end);
+                positions.push_back(position);
+                continue;
+            }
+            if (text[0] != 'f' || (text[1] != ' ' && text[1] != '\t'))
+                continue;
+
+            // "f 1 2 3", "f 1/1/1 2/2/2 3/3/3", ...: the position index
+            // comes first
+            ++text;
+            while (true) {
+                char *end;
+                long const index = strtol(text, &end, 10);
+                if (end == text)
+                    break;
+                text = end;
+                while (*text && *text != ' ' && *text != '\t')
+                    ++text;
+
+                size_t const vertex = index < 0 ? positions.size() + index
+                                                : index - 1;
+                if (index == 0 || vertex >= positions.size())
+                    throw runtime_error("Bad vertex index in " + filename
+                                        + '.');
+                corners[corner++] = vertex;
+                if (corner != 3)
+                    continue;
+                corner = 0;
+
+                BVH::Box box;
+                Mesh::Face const face = makeFace(positions[corners[0]],
+                    positions[corners[1]], positions[corners[2]], box);
+                hash.add(face);
+                ++triangles.count;
+
+                if (!triangles.spill
+                    && triangles.count * FACE_BUILD_BYTES > budget)
+                {
+                    triangles.spill.reset(new Spill(spillPath));
+                    for (size_t idx = 0; idx != triangles.faces.size(); ++idx)
+                        triangles.spill->add(triangles.faces[idx],
+                                             triangles.boxes[idx]);
+                    vector<Mesh::Face>().swap(triangles.faces);
+                    vector<BVH::Box>().swap(triangles.boxes);
+                }
+                if (triangles.spill) {
+                    triangles.spill->add(face, box);
+                } else {
+                    triangles.faces.push_back(face);
+                    triangles.boxes.push_back(box);
+                }
+            }
+        }
+
+        if (triangles.count == 0)
+            throw runtime_error("No triangles in " + filename + '.');
+        triangles.geometry = hash.value();
+        return triangles;
+    }
+
+    // nearby faces form a cluster, the tree over the clusters has one
+    // cluster per leaf
+    struct Clusters
+    {
+        vector<unsigned> order;     // faces, by cluster
+        vector<pair<unsigned, unsigned>> ranges;    // of order
+        vector<unsigned> leafOrder; // ranges in the tree's leaf order
+        vector<BVH::Node> tree;
+    };
+
+    Clusters cluster(vector<BVH::Box> const &boxes, bool fast)
+    {
+        Clusters clusters;
+        clusters.ranges = BVH::partition(boxes, CLUSTER_FACES,
+                                         clusters.order);
+
+        vector<BVH::Box> clusterBoxes;
+        for (auto const &range : clusters.ranges)
+            clusterBoxes.push_back(boundsOf(boxes, clusters.order,
+                                            range.first, range.second));
+        clusters.tree = BVH::build(clusterBoxes, 1, clusters.leafOrder,
+                                   fast);
+        return clusters;
+    }
+
+    // the pages of clusters ranges[which[0]], ranges[which[1]], ... built
+    // a batch at a time on several threads, passed on in that order to
+    // done(idx, page). Returns the bytes of their trees.
+    template <typename Done>
+    size_t buildPages(vector<Mesh::Face> const &faces,
+                      vector<BVH::Box> const &boxes,
+                      vector<unsigned> const &order,
+                      vector<pair<unsigned, unsigned>> const &ranges,
+                      vector<unsigned> const &which, bool fast, Done done)
+    {
+        vector<vector<char>> pages(min<size_t>(PAGE_BATCH, which.size()),
+                                   vector<char>(PageCache::PAGE_SIZE));
+        size_t nodeBytes = 0;
+        for (unsigned first = 0; first < which.size();
+             first += pages.size())
+        {
+            unsigned const count = min<size_t>(pages.size(),
+                                               which.size() - first);
+            Tasks::forEach(count, [&](unsigned idx) {
+                auto const &range = ranges[which[first + idx]];
+                writePage(faces, boxes, order, range.first, range.second,
+                          fast, pages[idx]);
+            });
+
+            for (unsigned idx = 0; idx != count; ++idx) {
+                done(first + idx, pages[idx]);
+                nodeBytes += reinterpret_cast<PageHeader const *>(
+                    pages[idx].data())->nodes * sizeof(BVH::Node);
+            }
+        }
+        return nodeBytes;
+    }
+
+    // cluster the faces into pages, written in the cluster tree's leaf
+    // order
+    void writePages(vector<Mesh::Face> const &faces,
+                    vector<BVH::Box> const &boxes, FileHeader header,
+                    string const &pagesFile)
+    {
+        Clusters const clustered = cluster(boxes, header.fastBuild);
+        auto const &clusters = clustered.tree;
+
+        header.pages = clustered.ranges.size();
+        header.clusters = clusters.size();
+        header.faces = faces.size();
+
+        TempFile out(pagesFile);
+        out.write(&header, sizeof header, 0);
+        out.write(clusters.data(), clusters.size() * sizeof(BVH::Node),
+                  sizeof header);
+        size_t const offset = pagesOffset(clusters.size());
+
+        size_t const nodeBytes = clusters.size() * sizeof(BVH::Node)
+            + buildPages(faces, boxes, clustered.order, clustered.ranges,
+                         clustered.leafOrder, header.fastBuild,
+                [&](unsigned idx, vector<char> const &page) {
+                    out.write(page.data(), page.size(),
+                              offset + size_t(idx) * page.size());
+                });
+        out.commit(pagesFile);
+
+        cout << "Wrote " << faces.size() << " triangles in "
+             << header.pages << " pages to " << pagesFile << " (BVH: "
+             << nodeBytes << " bytes).\n";
+    }
+
+    // --- out of core ---------------------------------------------------------
+
+    // split spilled faces by their box centres over a grid of GRID^3
+    // cells, again for cells too large to build in memory, into buckets
+    // that are not. Faces with one and the same centre cannot be split and
+    // stay together.
+    unsigned const GRID = 4;
+
+    void split(unique_ptr<Spill> spill, size_t budget, string const &path,
+               vector<unique_ptr<Spill>> &buckets)
+    {
+        if (spill->count() * FACE_BUILD_BYTES <= budget) {
+            buckets.push_back(move(spill));
+            return;
+        }
+
+        BVH::Box const centres = spill->centres();
+        vector<unique_ptr<Spill>> cells(GRID * GRID * GRID);
+        spill->forEach([&](Record const &record) {
+            unsigned cell = 0;
+            for (int axis = 0; axis != 3; ++axis) {
+                float const extent = centres.max[axis] - centres.min[axis];
+                float const centre = (record.box.min[axis]
+                                      + record.box.max[axis]) / 2;
+                unsigned const idx = extent > 0
+                    ? min(unsigned((centre - centres.min[axis]) / extent
+                                   * GRID), GRID - 1)
+                    : 0;
+                cell = cell * GRID + idx;
+            }
+            if (!cells[cell])
+                cells[cell].reset(new Spill(path));
+            cells[cell]->add(record.face, record.box);
+        });
+
+        size_t const count = spill->count();
+        spill.reset();
+        for (unique_ptr<Spill> &cell : cells) {
+            if (!cell)
+                continue;
+            if (cell->count() == count)
+                buckets.push_back(move(cell));
+            else
+                split(move(cell), budget, path, buckets);
+        }
+    }
+
+    // for meshes larger than the build memory: the faces are split into
+    // buckets of nearby faces, each clustered into pages in memory, and
+    // the tree over all clusters is built last. Only the vertex positions
+    // (while reading), one bucket and the clusters' boxes are in memory.
+    void writePagesOutOfCore(Triangles &triangles, FileHeader header,
+                             string const &pagesFile, size_t budget)
+    {
+        vector<unique_ptr<Spill>> buckets;
+        split(move(triangles.spill), budget, pagesFile, buckets);
+
+        // pages in bucket order, reordered once the tree is known
+        TempFile scratch(pagesFile);
+        scratch.unlink();
+        vector<BVH::Box> clusterBoxes;
+        size_t nodeBytes = 0;
+        for (unique_ptr<Spill> &bucket : buckets) {
+            vector<Mesh::Face> faces;
+            vector<BVH::Box> boxes;
+            faces.reserve(bucket->count());
+            boxes.reserve(bucket->count());
+            bucket->forEach([&](Record const &record) {
+                faces.push_back(record.face);
+                boxes.push_back(record.box);
+            });
+            bucket.reset();
+
+            vector<unsigned> order;
+            auto const ranges = BVH::partition(boxes, CLUSTER_FACES, order);
+            vector<unsigned> which(ranges.size());
+            for (unsigned idx = 0; idx != which.size(); ++idx)
+                which[idx] = idx;
+
+            size_t const first = clusterBoxes.size();
+            for (auto const &range : ranges)
+                clusterBoxes.push_back(boundsOf(boxes, order, range.first,
+                                                range.second));
+            nodeBytes += buildPages(faces, boxes, order, ranges, which,
+                                    header.fastBuild,
+                [&](unsigned idx, vector<char> const &page) {
+                    scratch.write(page.data(), page.size(),
+                                  (first + idx) * page.size());
+                });
+        }
+
+        vector<unsigned> leafOrder;
+        vector<BVH::Node> const clusters = BVH::build(clusterBoxes, 1,
+            leafOrder, header.fastBuild);
+        header.pages = clusterBoxes.size();
+        header.clusters = clusters.size();
+        header.faces = triangles.count;
+        nodeBytes += clusters.size() * sizeof(BVH::Node);
+
+        TempFile out(pagesFile);
+        out.write(&header, sizeof header, 0);
+        out.write(clusters.data(), clusters.size() * sizeof(BVH::Node),
+                  sizeof header);
+        size_t const offset = pagesOffset(clusters.size());
+        vector<char> page(PageCache::PAGE_SIZE);
+        for (size_t idx = 0; idx != leafOrder.size(); ++idx) {
+            scratch.read(page.data(), page.size(),
+                         size_t(leafOrder[idx]) * page.size());
+            out.write(page.data(), page.size(), offset + idx * page.size());
+        }
+        out.commit(pagesFile);
+
+        cout << "Wrote " << triangles.count << " triangles in "
+             << header.pages << " pages to " << pagesFile << " (BVH: "
+             << nodeBytes << " bytes, built out of core in "
+             << buckets.size() << " buckets).\n";
+    }
+
+    // the size the header implies: a file cut short (a crash while it
+    // was copied, a full disk) must not be trusted
+    bool complete(FileHeader const &header, off_t size)
+    {
+        return size_t(size) == pagesOffset(header.clusters)
+            + size_t(header.pages) * PageCache::PAGE_SIZE;
+    }
+
+    // the header of a page file, updated in place and flushed to disk. A
+    // file whose header may be half written is removed: it would be
+    // trusted by later runs, since the header matches the geometry.
+    void rewriteHeader(string const &pagesFile, FileHeader const &header)
+    {
+        int const fd = open(pagesFile.c_str(), O_WRONLY);
+        if (fd < 0)
+            throw runtime_error("Could not write " + pagesFile + '.');
+
+        char const *bytes = reinterpret_cast<char const *>(&header);
+        size_t done = 0;
+        bool written = true;
+        while (written && done != sizeof header) {
+            ssize_t const count = pwrite(fd, bytes + done,
+                                         sizeof header - done, done);
+            if (count < 0 && errno == EINTR)
+                continue;
+            written = count > 0;
+            if (written)
+                done += count;
+        }
+        written = written && fsync(fd) == 0;
+        written = close(fd) == 0 && written;
+
+        if (!written) {
+            unlink(pagesFile.c_str());
+            throw runtime_error("Could not write " + pagesFile + '.');
+        }
+    }
+
+    mutex &fileMutex(string const &pagesFile)
+    {
+        static mutex mapMutex;
+        static map<string, unique_ptr<mutex>> mutexes;
+
+        lock_guard<mutex> lock(mapMutex);
+        unique_ptr<mutex> &fileMutex = mutexes[pagesFile];
+        if (!fileMutex)
+            fileMutex.reset(new mutex);
+        return *fileMutex;
+    }
+
+    // --- tracing -------------------------------------------------------------
+
+    // Möller-Trumbore, as Triangle::intersect
+    double intersectFace(Mesh::Face const &face, double const O[3],
+                         double const D[3])
+    {
+        double const e1[3] = { face.e1[0], face.e1[1], face.e1[2] };
+        double const e2[3] = { face.e2[0], face.e2[1], face.e2[2] };
+
+        double const h[3] = { D[1] * e2[2] - D[2] * e2[1],
+                              D[2] * e2[0] - D[0] * e2[2],
+                              D[0] * e2[1] - D[1] * e2[0] };
+        double const a = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+        if (a > -DBL_EPSILON && a < DBL_EPSILON)
+            return -1;
+
+        double const f = 1 / a;
+        double const s[3] = { O[0] - face.v0[0], O[1] - face.v0[1],
+                              O[2] - face.v0[2] };
+        double const u = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+        if (u < 0.0 || u > 1.0)
+            return -1;
+
+        double const q[3] = { s[1] * e1[2] - s[2] * e1[1],
+                              s[2] * e1[0] - s[0] * e1[2],
+                              s[0] * e1[1] - s[1] * e1[0] };
+        double const v = f * (D[0] * q[0] + D[1] * q[1] + D[2] * q[2]);
+        if (v < 0.0 || u + v > 1.0)
+            return -1;
+
+        return f * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+    }
+}
+
+// faces kept in memory, a cluster's page is built the first time a ray
+// reaches it
+struct Mesh::Lazy
+{
+    struct Cluster
+    {
+        once_flag built;
+        vector<char> page;
+    };
+
+    vector<Face> faces;
+    vector<BVH::Box> boxes;
+    bool fast;
+    Clusters clusters;
+    unique_ptr<Cluster[]> pages;    // in leaf order
+    atomic<unsigned> built{ 0 };
+};
+
+char const *Mesh::lazyPage(unsigned cluster)
+{
+    Lazy::Cluster &page = d_lazy->pages[cluster];
+    call_once(page.built, [&] {
+        // done once per cluster rather than per ray
+        UncountedAllocations const uncounted;
+        MemoryUsage::Scope const scope(MemoryUsage::GEOMETRY);
+        auto const &range = d_lazy->clusters.ranges[
+            d_lazy->clusters.leafOrder[cluster]];
+        page.page.resize(PageCache::PAGE_SIZE);
+        writePage(d_lazy->faces, d_lazy->boxes, d_lazy->clusters.order,
+                  range.first, range.second, d_lazy->fast, page.page);
+        ++d_lazy->built;
+    });
+    return page.page.data();
+}
+
+unsigned Mesh::builtClusters() const
+{
+    return d_lazy ? d_lazy->built.load() : 0;
+}
+
+Hit Mesh::intersect(Ray const &ray)
+{
+    // uniform scaling keeps t the same in mesh coordinates
+    double O[3];
+    double D[3];
+    for (int axis = 0; axis != 3; ++axis) {
+        O[axis] = (ray.O.data[axis] - d_position.data[axis]) / d_scale;
+        D[axis] = ray.D.data[axis] / d_scale;
+    }
+
+    double tMin = numeric_limits<double>::infinity();
+    Vector N;
+
+    BVH::TraceRay const local = BVH::prepare(O, D, d_clusters[0]);
+    BVH::traverse(d_clusters, local, tMin,
+        [&](unsigned cluster, unsigned) {
+            unsigned const page = d_firstPage + cluster;
+            char const *data = d_lazy ? lazyPage(cluster)
+                                      : d_cache.acquire(page);
+
+            PageHeader const *header =
+                reinterpret_cast<PageHeader const *>(data);
+            BVH::Node const *nodes =
+                reinterpret_cast<BVH::Node const *>(header + 1);
+            Face const *faces =
+                reinterpret_cast<Face const *>(nodes + header->nodes);
+
+            BVH::traverse(nodes, local, tMin,
+                [&](unsigned first, unsigned count) {
+                    for (unsigned idx = first; idx != first + count; ++idx) {
+                        double const t = intersectFace(faces[idx], O, D);
+                        if (t > DBL_EPSILON && t < tMin) {
+                            tMin = t;
+                            Face const &face = faces[idx];
+                            N = Vector(face.e1[0], face.e1[1], face.e1[2])
+                                .cross(Vector(face.e2[0], face.e2[1],
+                                              face.e2[2]));
+                        }
+                    }
+                });
+
+            if (!d_lazy)
+                d_cache.release(page);
+        });
+
+    if (std::isinf(tMin))
+        return Hit::NO_HIT();
+
+    // determine orientation of the normal
+    N.normalize();
+    if (N.dot(ray.D) > 0)
+        N = -N;
+
+    return Hit(tMin, N);
+}
+
+BBox Mesh::bounds() const
+{
+    BVH::Box const box = BVH::bounds(d_clusters[0]);
+    return BBox(Point(box.min[0], box.min[1], box.min[2]) * d_scale
+                    + d_position,
+                Point(box.max[0], box.max[1], box.max[2]) * d_scale
+                    + d_position);
+}
+
+Mesh::Mesh(string const &filename, Point const &position, double scale,
+    PageCache &cache)
+:
+    d_cache(cache),
+    d_position(position),
+    d_scale(scale),
+    d_filename(filename)
+{}
+
+void Mesh::load(Settings const &settings)
+{
+    string const &filename = d_filename;
+    Timeline::Scope const event("mesh build", filename);
+
+    long long const modified = modificationTime(filename);
+    long long const size = fileSize(filename);
+    if (modified == 0)
+        throw runtime_error("Could not open " + filename + '.');
+
+    bool const fastBuild = settings.fast;
+    string const pagesFile = cacheFile(filename, settings.cacheDir);
+
+    // meshes of the same file loading at the same time: the first builds
+    // the page file, the others then find it up to date
+    lock_guard<mutex> building(fileMutex(pagesFile));
+
+    FileHeader header;
+    struct stat info;
+    bool const cached = ifstream(pagesFile, ios::binary).read(
+            reinterpret_cast<char *>(&header), sizeof header)
+        && memcmp(header.magic, MAGIC, sizeof MAGIC) == 0
+        && header.pageSize == PageCache::PAGE_SIZE
+        && stat(pagesFile.c_str(), &info) == 0
+        && complete(header, info.st_size);
+
+    // an OBJ file that changed on disk may still hold the same geometry
+    if (!cached || header.fastBuild != fastBuild
+        || header.modified != modified || header.size != size)
+    {
+        Triangles triangles = readFaces(filename, fastBuild,
+                                        settings.buildMemory, pagesFile);
+
+        // only the cluster tree now, no page file. Lazy meshes keep their
+        // faces in memory, one too large is built as usual.
+        if (settings.lazy && !triangles.spill) {
+            d_firstPage = 0;
+            d_lazy.reset(new Lazy);
+            d_lazy->fast = fastBuild;
+            d_lazy->clusters = cluster(triangles.boxes, fastBuild);
+            d_lazy->pages.reset(
+                new Lazy::Cluster[d_lazy->clusters.ranges.size()]);
+            d_lazy->faces.swap(triangles.faces);
+            d_lazy->boxes.swap(triangles.boxes);
+            d_clusters = d_lazy->clusters.tree.data();
+            return;
+        }
+
+        if (cached && header.geometry == triangles.geometry) {
+            header.modified = modified;
+            header.size = size;
+            rewriteHeader(pagesFile, header);
+        } else {
+            memcpy(header.magic, MAGIC, sizeof MAGIC);
+            header.pageSize = PageCache::PAGE_SIZE;
+            header.fastBuild = fastBuild;
+            header.unused = 0;
+            header.geometry = triangles.geometry;
+            header.modified = modified;
+            header.size = size;
+            if (triangles.spill)
+                writePagesOutOfCore(triangles, header, pagesFile,
+                                    settings.buildMemory);
+            else
+                writePages(triangles.faces, triangles.boxes, header,
+                           pagesFile);
+        }
+    }
+
+    map(pagesFile);
+}
+
+Mesh::~Mesh()
+{
+    if (d_map)
+        munmap(d_map, d_mapSize);
+}
+
+string Mesh::cacheFile(string const &filename, string const &cacheDir)
+{
+    if (cacheDir.empty())
+        return filename + ".pages";
+
+    // one file per OBJ file in the cache directory
+    char path[PATH_MAX];
+    string const absolute = realpath(filename.c_str(), path) ? path
+                                                             : filename;
+    Hash hash;
+    hash.add(absolute.data(), absolute.size());
+
+    mkdir(cacheDir.c_str(), 0777);
+    ostringstream name;
+    name << cacheDir << '/' << hex << setw(16) << setfill('0')
+         << hash.value() << ".pages";
+    return name.str();
+}
+
+void Mesh::map(string const &pagesFile)
+{
+    // the header and the cluster tree are mapped, the pages are read
+    // through the page cache
+    int const fd = open(pagesFile.c_str(), O_RDONLY);
+    FileHeader header;
+    struct stat info;
+    if (fd < 0 || pread(fd, &header, sizeof header, 0) != sizeof header
+        || fstat(fd, &info) != 0 || !complete(header, info.st_size))
+    {
+        if (fd >= 0)
+            close(fd);
+        throw runtime_error("Could not read " + pagesFile + '.');
+    }
+
+    d_mapSize = pagesOffset(header.clusters);
+    void *mapped = mmap(nullptr, d_mapSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw runtime_error("Could not map " + pagesFile + '.');
+
+    d_map = mapped;
+    d_clusters = reinterpret_cast<BVH::Node const *>(
+        static_cast<char const *>(mapped) + sizeof(FileHeader));
+    d_firstPage = d_cache.addFile(pagesFile, d_mapSize, header.pages);
+}
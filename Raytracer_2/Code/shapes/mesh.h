@@ -0,0 +1,102 @@
+#ifndef MESH_H_
+#define MESH_H_
+
+#include "../bvh.h"
+#include "../object.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class PageCache;
+
+// Triangle mesh from an OBJ file, for meshes that need not fit in memory.
+// Its triangles and their BVH are stored in pages in a file next to the
+// OBJ file (<file>.pages) or in a cache directory. Every page holds a
+// cluster of nearby triangles with its own small (compressed) BVH. Only
+// the tree over the clusters is mapped into memory, pages are read through
+// the scene's page cache when a ray reaches their cluster.
+//
+// The page file records a hash of the geometry and the build settings. It
+// is used right away while the OBJ file's time and size are unchanged,
+// otherwise the OBJ file is read and the pages are only built again when
+// the hash differs.
+//
+// The OBJ file is streamed. A mesh whose build needs more than the build
+// memory is spilled to disk, split into buckets of nearby triangles that
+// are clustered one at a time, and the tree over all clusters is built
+// last; only its vertex positions need to fit in memory.
+//
+// A lazy mesh without an up to date page file only builds the cluster
+// tree up front and keeps the triangles in memory; a cluster's page is
+// built the first time a ray reaches it, clusters no ray reaches are
+// never built.
+class Mesh: public Object
+{
+    public:
+        // a vertex and the two edges from it
+        struct Face
+        {
+            float v0[3];
+            float e1[3];
+            float e2[3];
+        };
+
+        struct Settings
+        {
+            std::string cacheDir;   // for the page file, if not next to
+                                    // the OBJ file
+            bool fast = false;      // median splits instead of SAH
+            bool lazy = false;      // build pages when first needed
+            // bytes for building pages in memory, larger meshes are
+            // built out of core
+            size_t buildMemory = size_t(1) << 30;
+        };
+
+    private:
+        PageCache &d_cache;
+        unsigned d_firstPage;       // id of the first page in the cache
+        void *d_map = nullptr;      // start of the page file
+        size_t d_mapSize = 0;
+        // in the map (or built in memory), leaves are pages
+        BVH::Node const *d_clusters = nullptr;
+        Point d_position;
+        double d_scale;
+        std::string d_filename;
+
+        struct Lazy;
+        std::unique_ptr<Lazy> d_lazy;   // lazy meshes only
+
+    public:
+        // the mesh is scaled uniformly and then moved to position. Nothing
+        // is read until load().
+        Mesh(std::string const &filename, Point const &position,
+             double scale, PageCache &cache);
+        virtual ~Mesh();
+
+        Mesh(Mesh const &) = delete;
+        Mesh &operator=(Mesh const &) = delete;
+
+        // read the OBJ file and build (or reuse) the page file; meshes
+        // may be loaded on several threads at once. A fast build splits
+        // at medians instead of by surface area, for previews.
+        void load(Settings const &settings);
+
+        virtual Hit intersect(Ray const &ray);
+        virtual Color colorAtTexture(Point N, bool rotate) { return Color(); };
+        virtual bool isRotated() { return false; };
+        virtual Vector rotate(Point point) { return Vector(); };
+        virtual BBox bounds() const;
+        virtual bool convex() const { return false; };
+
+        unsigned builtClusters() const;     // by a lazy mesh so far
+
+    private:
+        static std::string cacheFile(std::string const &filename,
+                                     std::string const &cacheDir);
+        void map(std::string const &pagesFile);
+        char const *lazyPage(unsigned cluster);
+};
+
+#endif
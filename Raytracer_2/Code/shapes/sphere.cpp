@@ -51,7 +51,7 @@ Color Sphere::colorAtTexture(Point point, bool hasToRotate)
     double u = 0.5 + atan2(-N.y, -N.x) / (PI * 2);
     double v = 0.5 - asin(N.z) / PI;
 
-    Color color = material.texture.colorAt(u, v);
+    Color color = material.texture->colorAt(u, v);
     return color;
 }
 
@@ -69,6 +69,11 @@ Vector Sphere::rotate(Vector normalVector)
     return normalRotated.normalized();
 }
 
+BBox Sphere::bounds() const
+{
+    return BBox(position - r, position + r);
+}
+
 Sphere::Sphere(Point const &pos, double radius, Vector rot, int ang)
 :
     position(pos),
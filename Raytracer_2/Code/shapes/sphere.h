@@ -13,6 +13,7 @@ class Sphere: public Object
 
         virtual bool isRotated() { return (angle != -1); };
         virtual Vector rotate(Point point);
+        virtual BBox bounds() const;
 
         Point const position;
         double const r;
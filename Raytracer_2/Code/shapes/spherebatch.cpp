@@ -0,0 +1,253 @@
+#include "spherebatch.h"
+#include "sphere.h"
+
+#include <cmath>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+void SphereBatch::clear()
+{
+    d_cx.clear();
+    d_cy.clear();
+    d_cz.clear();
+    d_r2.clear();
+    d_spheres.clear();
+    d_index.clear();
+    d_sealed = 0;
+}
+
+void SphereBatch::add(Sphere *sphere, unsigned index)
+{
+    // fill the padding of the last block first
+    unsigned slot = d_spheres.size();
+    while (slot != d_sealed && d_spheres[slot - 1] == nullptr)
+        --slot;
+
+    if (slot == d_spheres.size())
+    {
+        // new block of unhittable spheres: -inf radius squared makes the
+        // discriminant -inf
+        float const never = -numeric_limits<float>::infinity();
+        d_cx.resize(slot + WIDTH, 0.0f);
+        d_cy.resize(slot + WIDTH, 0.0f);
+        d_cz.resize(slot + WIDTH, 0.0f);
+        d_r2.resize(slot + WIDTH, never);
+        d_spheres.resize(slot + WIDTH, nullptr);
+        d_index.resize(slot + WIDTH, 0);
+    }
+
+    d_cx[slot] = sphere->position.x;
+    d_cy[slot] = sphere->position.y;
+    d_cz[slot] = sphere->position.z;
+    d_r2[slot] = sphere->r * sphere->r;
+    d_spheres[slot] = sphere;
+    d_index[slot] = index;
+}
+
+void SphereBatch::endBlock()
+{
+    d_sealed = d_spheres.size();
+}
+
+unsigned SphereBatch::size() const
+{
+    return d_spheres.size();
+}
+
+unsigned SphereBatch::blocks() const
+{
+    return d_spheres.size() / WIDTH;
+}
+
+int SphereBatch::closest(Ray const &ray, Hit *min_hit,
+    Object const *exclusion, unsigned first, unsigned last) const
+{
+    int found = -1;
+    for (unsigned block = first; block != last; ++block)
+    {
+        unsigned mask = candidates(ray, block, min_hit->t);
+        for (unsigned lane = 0; mask != 0; ++lane, mask >>= 1)
+        {
+            unsigned idx = block * WIDTH + lane;
+            Sphere *sphere = d_spheres[idx];
+            if (!(mask & 1) || !sphere || sphere == exclusion)
+                continue;
+
+            // exact test, non-virtual
+            Hit hit(sphere->Sphere::intersect(ray));
+            if (hit.t < min_hit->t)
+            {
+                *min_hit = hit;
+                found = d_index[idx];
+            }
+        }
+    }
+    return found;
+}
+
+int SphereBatch::closest(Ray const &ray, Hit *min_hit,
+    Object const *exclusion) const
+{
+    return closest(ray, min_hit, exclusion, 0, blocks());
+}
+
+int SphereBatch::occluded(Ray const &ray, double maxT, Object const *skip0,
+    Object const *skip1, unsigned first, unsigned last) const
+{
+    for (unsigned block = first; block != last; ++block)
+    {
+        unsigned mask = candidates(ray, block, maxT);
+        for (unsigned lane = 0; mask != 0; ++lane, mask >>= 1)
+        {
+            unsigned idx = block * WIDTH + lane;
+            Sphere *sphere = d_spheres[idx];
+            if (!(mask & 1) || !sphere || sphere == skip0
+                || sphere == skip1)
+                continue;
+
+            if (sphere->Sphere::intersect(ray).t < maxT)
+                return d_index[idx];
+        }
+    }
+    return -1;
+}
+
+int SphereBatch::occluded(Ray const &ray, double maxT, Object const *skip0,
+    Object const *skip1) const
+{
+    return occluded(ray, maxT, skip0, skip1, 0, blocks());
+}
+
+// The kernel solves the same quadratic as Sphere::intersect, for 4 spheres
+// at once and without branches. Single precision is not exact, so the
+// discriminant and t are given some slack: a lane is only dropped when it
+// certainly misses. Padding lanes have discr = -inf, tol = -inf, so they
+// are always dropped.
+
+#ifdef __SSE2__
+
+unsigned SphereBatch::candidates(Ray const &ray, unsigned block,
+    double maxT) const
+{
+    unsigned const base = block * WIDTH;
+
+    __m128 const dx = _mm_set1_ps(ray.D.x);
+    __m128 const dy = _mm_set1_ps(ray.D.y);
+    __m128 const dz = _mm_set1_ps(ray.D.z);
+    __m128 const a = _mm_set1_ps(ray.D.dot(ray.D));
+    __m128 const r2 = _mm_loadu_ps(&d_r2[base]);
+
+    __m128 const lx = _mm_sub_ps(_mm_set1_ps(ray.O.x),
+                                 _mm_loadu_ps(&d_cx[base]));
+    __m128 const ly = _mm_sub_ps(_mm_set1_ps(ray.O.y),
+                                 _mm_loadu_ps(&d_cy[base]));
+    __m128 const lz = _mm_sub_ps(_mm_set1_ps(ray.O.z),
+                                 _mm_loadu_ps(&d_cz[base]));
+
+    __m128 const dl = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, lx),
+                                            _mm_mul_ps(dy, ly)),
+                                 _mm_mul_ps(dz, lz));
+    __m128 const ll = _mm_add_ps(_mm_add_ps(_mm_mul_ps(lx, lx),
+                                            _mm_mul_ps(ly, ly)),
+                                 _mm_mul_ps(lz, lz));
+
+    __m128 const b = _mm_add_ps(dl, dl);
+    __m128 const c = _mm_sub_ps(ll, r2);
+    __m128 const bb = _mm_mul_ps(b, b);
+    __m128 const four_a = _mm_mul_ps(_mm_set1_ps(4.0f), a);
+    __m128 const discr = _mm_sub_ps(bb, _mm_mul_ps(four_a, c));
+
+    // rounding error of discr is bounded by a fraction of its terms
+    __m128 const tol = _mm_mul_ps(_mm_set1_ps(1e-5f),
+        _mm_add_ps(bb, _mm_mul_ps(four_a, _mm_add_ps(ll, r2))));
+    __m128 const real = _mm_cmpge_ps(discr, _mm_sub_ps(_mm_setzero_ps(), tol));
+
+    // q = -0.5 * (b + sign(b) * sqrt(discr)), x0 = q / a, x1 = c / q
+    __m128 const sign = _mm_set1_ps(-0.0f);
+    __m128 const sd = _mm_sqrt_ps(_mm_max_ps(discr, _mm_setzero_ps()));
+    __m128 const q = _mm_mul_ps(_mm_set1_ps(-0.5f),
+        _mm_add_ps(b, _mm_or_ps(sd, _mm_and_ps(b, sign))));
+    __m128 const x0 = _mm_div_ps(q, a);
+    __m128 const x1 = _mm_div_ps(c, q);
+    __m128 const tnear = _mm_min_ps(x0, x1);
+    __m128 const tfar = _mm_max_ps(x0, x1);
+
+    // slack on t: relative error, plus the effect of the errors in the
+    // discriminant (sqrt(tol)) and in c (cerr), which grow for grazing rays
+    __m128 const abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 const cerr = _mm_mul_ps(_mm_set1_ps(1e-5f), _mm_add_ps(ll, r2));
+    __m128 const slack = _mm_add_ps(
+        _mm_add_ps(_mm_set1_ps(1e-3f),
+                   _mm_mul_ps(_mm_set1_ps(1e-4f),
+                              _mm_add_ps(_mm_and_ps(tnear, abs_mask),
+                                         _mm_and_ps(tfar, abs_mask)))),
+        _mm_add_ps(_mm_div_ps(_mm_sqrt_ps(_mm_max_ps(tol, _mm_setzero_ps())),
+                              a),
+                   _mm_div_ps(cerr, _mm_and_ps(q, abs_mask))));
+
+    float const limit = maxT < numeric_limits<float>::max() ?
+        static_cast<float>(maxT) : numeric_limits<float>::infinity();
+
+    __m128 const ahead = _mm_cmpge_ps(_mm_add_ps(tfar, slack),
+                                      _mm_setzero_ps());
+    __m128 const before = _mm_cmplt_ps(_mm_sub_ps(tnear, slack),
+                                       _mm_set1_ps(limit));
+    // q == 0 only for a ray starting on a grazing tangent point
+    __m128 const degenerate = _mm_cmpeq_ps(q, _mm_setzero_ps());
+
+    __m128 const hit = _mm_and_ps(real,
+        _mm_or_ps(_mm_and_ps(ahead, before), degenerate));
+    return _mm_movemask_ps(hit);
+}
+
+#else
+
+unsigned SphereBatch::candidates(Ray const &ray, unsigned block,
+    double maxT) const
+{
+    unsigned const base = block * WIDTH;
+    float const a = ray.D.dot(ray.D);
+    float const limit = maxT < numeric_limits<float>::max() ?
+        static_cast<float>(maxT) : numeric_limits<float>::infinity();
+
+    unsigned mask = 0;
+    for (unsigned lane = 0; lane != WIDTH; ++lane)
+    {
+        float const lx = static_cast<float>(ray.O.x) - d_cx[base + lane];
+        float const ly = static_cast<float>(ray.O.y) - d_cy[base + lane];
+        float const lz = static_cast<float>(ray.O.z) - d_cz[base + lane];
+        float const r2 = d_r2[base + lane];
+
+        float const dl = static_cast<float>(ray.D.x) * lx
+                       + static_cast<float>(ray.D.y) * ly
+                       + static_cast<float>(ray.D.z) * lz;
+        float const ll = lx * lx + ly * ly + lz * lz;
+
+        float const b = dl + dl;
+        float const c = ll - r2;
+        float const discr = b * b - 4.0f * a * c;
+        float const tol = 1e-5f * (b * b + 4.0f * a * (ll + r2));
+
+        float const sd = sqrt(fmax(discr, 0.0f));
+        float const q = -0.5f * (b + copysign(sd, b));
+        float const x0 = q / a;
+        float const x1 = c / q;
+        float const tnear = fmin(x0, x1);
+        float const tfar = fmax(x0, x1);
+        float const cerr = 1e-5f * (ll + r2);
+        float const slack = 1e-3f + 1e-4f * (fabs(tnear) + fabs(tfar))
+            + sqrt(fmax(tol, 0.0f)) / a + cerr / fabs(q);
+
+        bool const hit = discr >= -tol
+            && ((tfar + slack >= 0.0f && tnear - slack < limit) || q == 0.0f);
+        mask |= static_cast<unsigned>(hit) << lane;
+    }
+    return mask;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef SPHEREBATCH_H_
+#define SPHEREBATCH_H_
+
+#include "../hit.h"
+#include "../ray.h"
+
+#include <vector>
+
+class Object;
+class Sphere;
+
+// Packed (structure of arrays) store of spheres. Rays are tested against
+// a block of 4 spheres at a time with a branch-free single precision
+// kernel. It is conservative: spheres it reports as candidates are then
+// intersected exactly by Sphere::intersect, so results match the scalar
+// path.
+//
+// Spheres are stored in blocks of 4 (the last one padded with spheres that
+// can never be hit). A block range can be used as the leaf of an
+// acceleration structure.
+class SphereBatch
+{
+    public:
+        static unsigned const WIDTH = 4;
+
+    private:
+        std::vector<float> d_cx;
+        std::vector<float> d_cy;
+        std::vector<float> d_cz;
+        std::vector<float> d_r2;            // radius squared
+        std::vector<Sphere *> d_spheres;    // nullptr for padding
+        std::vector<unsigned> d_index;      // index in the scene's objects
+        unsigned d_sealed = 0;              // padding before it stays
+
+    public:
+        void clear();
+        void add(Sphere *sphere, unsigned index);
+        // spheres added after this start a new block, so the blocks so
+        // far can be a leaf of their own
+        void endBlock();
+
+        unsigned size() const;              // spheres, including padding
+        unsigned blocks() const;
+
+        // closest hit with t < min_hit->t in blocks [first, last), ignoring
+        // exclusion. On a hit, *min_hit is updated and the scene index of
+        // the sphere returned, otherwise -1.
+        int closest(Ray const &ray, Hit *min_hit, Object const *exclusion,
+                    unsigned first, unsigned last) const;
+        int closest(Ray const &ray, Hit *min_hit,
+                    Object const *exclusion) const;
+
+        // any hit with t < maxT in blocks [first, last), ignoring skip0 and
+        // skip1; returns the sphere's scene index or -1
+        int occluded(Ray const &ray, double maxT, Object const *skip0,
+                     Object const *skip1, unsigned first,
+                     unsigned last) const;
+        int occluded(Ray const &ray, double maxT, Object const *skip0,
+                     Object const *skip1) const;
+
+    private:
+        // bit mask of lanes in block that may hit before maxT
+        unsigned candidates(Ray const &ray, unsigned block,
+                            double maxT) const;
+};
+
+#endif
@@ -37,6 +37,15 @@ Hit Triangle::intersect(Ray const &ray)
     return Hit(t, normal);
 }
 
+BBox Triangle::bounds() const
+{
+    BBox box;
+    box.extend(v0);
+    box.extend(v1);
+    box.extend(v2);
+    return box;
+}
+
 Triangle::Triangle(Point const &v0,
          Point const &v1,
          Point const &v2)
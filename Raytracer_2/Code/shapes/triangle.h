@@ -14,6 +14,7 @@ class Triangle: public Object
         virtual Color colorAtTexture(Point N, bool rotate){ return Color(); };
         virtual bool isRotated() { return false; };
         virtual Vector rotate(Point point) { return Vector(); };
+        virtual BBox bounds() const;
 
         Point v0;
         Point v1;
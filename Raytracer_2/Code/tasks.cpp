@@ -0,0 +1,143 @@
+#include "tasks.h"
+
+#include "memoryusage.h"
+
+#include <algorithm>
+#include <atomic>
+
+using namespace std;
+
+namespace
+{
+    // threads that may still be started
+    atomic<int> &spare()
+    {
+        static atomic<int> count(max(1u, thread::hardware_concurrency()) - 1);
+        return count;
+    }
+
+    bool reserve()
+    {
+        int count = spare().load();
+        while (count > 0)
+            if (spare().compare_exchange_weak(count, count - 1))
+                return true;
+        return false;
+    }
+}
+
+void Tasks::setThreads(unsigned threads)
+{
+    spare() = max(1u, threads) - 1;
+}
+
+void Tasks::invoke(function<void()> const &first,
+    function<void()> const &second)
+{
+    if (!reserve()) {
+        first();
+        second();
+        return;
+    }
+
+    // memory is charged as if the caller did the work
+    unsigned const category = MemoryUsage::category();
+    exception_ptr failed;
+    thread other([&] {
+        MemoryUsage::Scope scope(category);
+        try {
+            second();
+        } catch (...) {
+            failed = current_exception();
+        }
+    });
+
+    try {
+        first();
+    } catch (...) {
+        other.join();
+        ++spare();
+        throw;
+    }
+    other.join();
+    ++spare();
+    if (failed)
+        rethrow_exception(failed);
+}
+
+void Tasks::forEach(unsigned count, function<void(unsigned)> const &task)
+{
+    atomic<unsigned> next(0);
+    mutex failedMutex;
+    exception_ptr failed;
+    unsigned const category = MemoryUsage::category();
+
+    auto work = [&] {
+        MemoryUsage::Scope scope(category);
+        for (unsigned idx = next++; idx < count; idx = next++) {
+            try {
+                task(idx);
+            } catch (...) {
+                lock_guard<mutex> lock(failedMutex);
+                if (!failed)
+                    failed = current_exception();
+            }
+        }
+    };
+
+    vector<thread> helpers;
+    while (helpers.size() + 1 < count && reserve())
+        helpers.emplace_back(work);
+    work();
+
+    for (thread &helper : helpers) {
+        helper.join();
+        ++spare();
+    }
+    if (failed)
+        rethrow_exception(failed);
+}
+
+Tasks::Group::~Group()
+{
+    join();
+}
+
+void Tasks::Group::run(function<void()> const &task)
+{
+    unsigned const category = MemoryUsage::category();
+    auto guarded = [this, task, category] {
+        MemoryUsage::Scope scope(category);
+        try {
+            task();
+        } catch (...) {
+            lock_guard<mutex> lock(d_mutex);
+            if (!d_failed)
+                d_failed = current_exception();
+        }
+    };
+
+    if (reserve())
+        d_threads.emplace_back(guarded);
+    else
+        guarded();
+}
+
+void Tasks::Group::wait()
+{
+    join();
+    if (d_failed) {
+        exception_ptr failed = d_failed;
+        d_failed = nullptr;
+        rethrow_exception(failed);
+    }
+}
+
+void Tasks::Group::join()
+{
+    for (thread &worker : d_threads) {
+        worker.join();
+        ++spare();
+    }
+    d_threads.clear();
+}
@@ -0,0 +1,59 @@
+#ifndef TASKS_H_
+#define TASKS_H_
+
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join helpers for building acceleration structures, which happens
+// while a scene is read, outside the render threads. Nested calls share
+// one budget of threads: work only moves to a new thread while fewer than
+// the budget are busy, otherwise it runs on the calling thread. Tasks
+// charge their memory to the caller's MemoryUsage category.
+class Tasks
+{
+    public:
+        // threads busy at most, including the calling one (default: one
+        // per hardware thread)
+        static void setThreads(unsigned threads);
+
+        // run both, possibly at the same time
+        static void invoke(std::function<void()> const &first,
+                           std::function<void()> const &second);
+
+        // run task(idx) for every idx in [0, count), in any order. The
+        // first exception thrown is passed on once all are done.
+        static void forEach(unsigned count,
+                            std::function<void(unsigned)> const &task);
+
+        class Group;
+};
+
+// Tasks started one at a time, while the caller goes on, and waited for
+// together. A task runs on a thread of its own while the budget allows,
+// otherwise right away on the calling thread.
+class Tasks::Group
+{
+    std::vector<std::thread> d_threads;
+    std::mutex d_mutex;
+    std::exception_ptr d_failed;    // first exception thrown by a task
+
+    public:
+        Group() = default;
+        ~Group();                   // waits, dropping exceptions
+
+        Group(Group const &) = delete;
+        Group &operator=(Group const &) = delete;
+
+        void run(std::function<void()> const &task);
+
+        // wait for all tasks, then pass on the first exception thrown
+        void wait();
+
+    private:
+        void join();
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "texturecache.h"
+
+#include "filetime.h"
+#include "memoryusage.h"
+#include "timeline.h"
+
+using namespace std;
+
+TexturePtr TextureCache::load(string const &filename, bool srgb)
+{
+    long long const modified = modificationTime(filename);
+    shared_future<TexturePtr> pending;
+    promise<TexturePtr> decoded;
+    {
+        lock_guard<mutex> lock(d_mutex);
+        auto const key = make_pair(filename, srgb);
+        auto found = d_textures.find(key);
+        if (found != d_textures.end() && found->second.modified == modified)
+            pending = found->second.texture;
+        else
+            d_textures[key] = Entry{ modified,
+                                     decoded.get_future().share() };
+    }
+    if (pending.valid())
+        return pending.get();
+
+    // decoded outside the lock, other textures can be decoded meanwhile
+    MemoryUsage::Scope const scope(MemoryUsage::TEXTURES);
+    Timeline::Scope const event("texture decode", filename);
+    try {
+        TexturePtr texture = make_shared<Image const>(filename, srgb);
+        decoded.set_value(texture);
+        return texture;
+    } catch (...) {
+        decoded.set_exception(current_exception());
+        throw;
+    }
+}
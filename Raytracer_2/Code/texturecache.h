@@ -0,0 +1,37 @@
+#ifndef TEXTURECACHE_H_
+#define TEXTURECACHE_H_
+
+#include "image.h"
+
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+typedef std::shared_ptr<Image const> TexturePtr;
+
+// Decoded textures by file name and decoding. A texture is decoded once
+// and shared by every material (and scene) using it, until its file
+// changes. Textures for sRGB output are decoded through the sRGB curve,
+// so they are lit in linear terms like the rest of the scene; otherwise
+// their bytes are taken as they are. Scenes may
+// be parsed by several threads at once; different textures are decoded at
+// the same time, a thread asking for a texture being decoded waits for it.
+class TextureCache
+{
+    struct Entry
+    {
+        long long modified;
+        std::shared_future<TexturePtr> texture;
+    };
+
+    std::mutex d_mutex;
+    std::map<std::pair<std::string, bool>, Entry> d_textures;
+
+    public:
+        TexturePtr load(std::string const &filename, bool srgb = false);
+};
+
+#endif
@@ -0,0 +1,69 @@
+#include "threadpool.h"
+
+#include "timeline.h"
+
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (threads == 0)
+        threads = max(1u, thread::hardware_concurrency());
+
+    for (unsigned idx = 0; idx != threads; ++idx)
+        d_workers.emplace_back(&ThreadPool::work, this, idx);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(d_mutex);
+        d_stop = true;
+    }
+    d_wake.notify_all();
+
+    for (thread &worker : d_workers)
+        worker.join();
+}
+
+unsigned ThreadPool::size() const
+{
+    return d_workers.size();
+}
+
+void ThreadPool::run(function<void(unsigned)> const &task)
+{
+    unique_lock<mutex> lock(d_mutex);
+    d_task = &task;
+    d_busy = d_workers.size();
+    ++d_generation;
+    d_wake.notify_all();
+
+    d_done.wait(lock, [this] { return d_busy == 0; });
+    d_task = nullptr;
+}
+
+void ThreadPool::work(unsigned index)
+{
+    Timeline::nameThread("worker " + to_string(index));
+    unsigned seen = 0;
+    while (true)
+    {
+        function<void(unsigned)> const *task;
+        {
+            unique_lock<mutex> lock(d_mutex);
+            d_wake.wait(lock, [&] { return d_stop || d_generation != seen; });
+            if (d_stop)
+                return;
+            seen = d_generation;
+            task = d_task;
+        }
+
+        (*task)(index);
+
+        lock_guard<mutex> lock(d_mutex);
+        if (--d_busy == 0)
+            d_done.notify_one();
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, created once and reused for every frame.
+class ThreadPool
+{
+    std::vector<std::thread> d_workers;
+
+    std::mutex d_mutex;
+    std::condition_variable d_wake;
+    std::condition_variable d_done;
+
+    std::function<void(unsigned)> const *d_task = nullptr;
+    unsigned d_generation = 0;      // bumped for every run()
+    unsigned d_busy = 0;            // workers still in the current run
+    bool d_stop = false;
+
+    public:
+        // 0 threads: one per hardware thread
+        explicit ThreadPool(unsigned threads = 0);
+        ~ThreadPool();
+
+        ThreadPool(ThreadPool const &) = delete;
+        ThreadPool &operator=(ThreadPool const &) = delete;
+
+        unsigned size() const;
+
+        // run task(worker index) once on every worker, return when all
+        // are done. Not reentrant.
+        void run(std::function<void(unsigned)> const &task);
+
+    private:
+        void work(unsigned index);
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "timeline.h"
+
+#include "allocationcount.h"
+
+#include "json/json.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace
+{
+    struct Event
+    {
+        char const *name;
+        string detail;
+        int x;
+        int y;
+        long long begin;        // nanoseconds since enable()
+        long long end;
+    };
+
+    // events of one thread, kept after it ends
+    struct ThreadEvents
+    {
+        unsigned id;
+        string name;
+        vector<Event> events;
+    };
+
+    atomic<bool> isEnabled(false);
+    chrono::steady_clock::time_point origin;
+
+    mutex &threadsMutex()
+    {
+        static mutex threadsMutex;
+        return threadsMutex;
+    }
+
+    vector<unique_ptr<ThreadEvents>> &threads()
+    {
+        static vector<unique_ptr<ThreadEvents>> threads;
+        return threads;
+    }
+
+    thread_local ThreadEvents *own = nullptr;
+
+    // the calling thread's events, only locked on its first event
+    ThreadEvents &ownEvents()
+    {
+        if (!own) {
+            lock_guard<mutex> lock(threadsMutex());
+            threads().emplace_back(new ThreadEvents);
+            own = threads().back().get();
+            own->id = threads().size();
+            own->name = "thread " + to_string(own->id);
+            own->events.reserve(1024);
+        }
+        return *own;
+    }
+
+    long long now()
+    {
+        return chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - origin).count();
+    }
+
+    // nanoseconds to the microseconds of the trace format
+    double microseconds(long long nanoseconds)
+    {
+        return nanoseconds / 1000.0;
+    }
+}
+
+void Timeline::enable()
+{
+    origin = chrono::steady_clock::now();
+    isEnabled.store(true);
+}
+
+bool Timeline::enabled()
+{
+    return isEnabled.load(memory_order_relaxed);
+}
+
+void Timeline::nameThread(string const &name)
+{
+    if (enabled())
+        ownEvents().name = name;
+}
+
+bool Timeline::write(string const &filename)
+{
+    ofstream out(filename);
+    out << fixed << setprecision(3) << "{\"traceEvents\":[";
+
+    lock_guard<mutex> lock(threadsMutex());
+    char const *separator = "\n";
+    for (auto const &thread : threads()) {
+        out << separator << "{\"name\":\"thread_name\",\"ph\":\"M\","
+            << "\"pid\":1,\"tid\":" << thread->id
+            << ",\"args\":{\"name\":" << json(thread->name).dump() << "}}";
+        separator = ",\n";
+
+        for (Event const &event : thread->events) {
+            out << separator << "{\"name\":" << json(event.name).dump()
+                << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread->id
+                << ",\"ts\":" << microseconds(event.begin)
+                << ",\"dur\":" << microseconds(event.end - event.begin)
+                << ",\"args\":{";
+            if (event.x >= 0)
+                out << "\"x\":" << event.x << ",\"y\":" << event.y;
+            else if (!event.detail.empty())
+                out << "\"detail\":" << json(event.detail).dump();
+            out << "}}";
+        }
+    }
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return static_cast<bool>(out);
+}
+
+Timeline::Scope::Scope(char const *name)
+:
+    d_name(name)
+{
+    if (enabled())
+        d_begin = now();
+}
+
+Timeline::Scope::Scope(char const *name, string const &detail)
+:
+    d_name(name)
+{
+    if (enabled()) {
+        d_detail = detail;
+        d_begin = now();
+    }
+}
+
+Timeline::Scope::Scope(char const *name, unsigned x, unsigned y)
+:
+    d_name(name)
+{
+    if (enabled()) {
+        d_x = x;
+        d_y = y;
+        d_begin = now();
+    }
+}
+
+Timeline::Scope::~Scope()
+{
+    if (d_begin < 0)
+        return;
+
+    long long const end = now();
+    // a tile's event is recorded while its allocations are checked
+    UncountedAllocations const uncounted;
+    ownEvents().events.push_back(
+        Event{ d_name, move(d_detail), d_x, d_y, d_begin, end });
+}
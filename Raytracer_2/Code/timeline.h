@@ -0,0 +1,45 @@
+#ifndef TIMELINE_H_
+#define TIMELINE_H_
+
+#include <string>
+
+// What each thread did when, for finding load imbalance. While enabled,
+// every Scope becomes an event on its thread's timeline; write() saves
+// them in the Chrome Trace Event format, which chrome://tracing and
+// Perfetto (ui.perfetto.dev) show. Disabled, a Scope costs a relaxed load.
+class Timeline
+{
+    public:
+        class Scope;
+
+        static void enable();               // before the first Scope
+        static bool enabled();
+
+        // label of the calling thread's timeline, if enabled
+        static void nameThread(std::string const &name);
+
+        // all events recorded so far; no Scope may be open meanwhile.
+        // False if the file could not be written.
+        static bool write(std::string const &filename);
+};
+
+// an event from construction to destruction. The name is not copied.
+class Timeline::Scope
+{
+    char const *d_name;
+    std::string d_detail;       // shown with the event, e.g. a file name
+    int d_x = -1;               // tile position, if any
+    int d_y = -1;
+    long long d_begin = -1;     // nanoseconds, -1 when disabled
+
+    public:
+        explicit Scope(char const *name);
+        Scope(char const *name, std::string const &detail);
+        Scope(char const *name, unsigned x, unsigned y);
+        ~Scope();
+
+        Scope(Scope const &) = delete;
+        Scope &operator=(Scope const &) = delete;
+};
+
+#endif
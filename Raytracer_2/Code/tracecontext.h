@@ -0,0 +1,47 @@
+#ifndef TRACECONTEXT_H_
+#define TRACECONTEXT_H_
+
+#include "pixelrecord.h"
+#include "renderstats.h"
+#include "rng.h"
+
+#include <vector>
+
+class Object;
+struct PixelGuide;
+
+// Mutable state used while tracing. The scene itself is only read during
+// rendering, everything that changes per ray lives here. Each render
+// thread owns one.
+struct TraceContext
+{
+    Rng rng;
+    RenderStats stats;
+
+    // per light: the object that blocked its last shadow ray. Neighbouring
+    // shading points are usually blocked by the same object, so it is
+    // tested before all others.
+    std::vector<Object *> occluders;
+
+    // lights reaching the hit being shaded and their weights, room for
+    // every light of the scene
+    std::vector<unsigned> shadeLights;
+    std::vector<float> shadeWeights;
+
+    // when set, everything the current pixel depends on is recorded here
+    PixelRecord *record = nullptr;
+
+    // when set, what the camera rays of the current pixel hit first is
+    // added here, for the denoiser
+    PixelGuide *guide = nullptr;
+
+    // sized for a scene with this many lights
+    void reset(unsigned lights)
+    {
+        occluders.assign(lights, nullptr);
+        shadeLights.resize(lights);
+        shadeWeights.resize(lights);
+    }
+};
+
+#endif